@@ -1,111 +1,477 @@
 #include "evaluation.h"
+#include <cstring>
+#include <stdexcept>
+#include <thread>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
-void game_state_to_input(const std::array<int, 64>& piece_on_square, std::vector<int>& active_features_w, std::vector<int>& active_features_b) {
-    // convert the game state to a NN input
+// default network, embedded in the executable when compiled with -DEVALFILE=\"path/to/network.nnue\"
+#ifdef EVALFILE
+asm(".section .rodata\n"
+    ".balign 64\n"
+    ".global embedded_network_data\n"
+    "embedded_network_data:\n"
+    ".incbin \"" EVALFILE "\"\n"
+    ".global embedded_network_end\n"
+    "embedded_network_end:\n"
+    ".previous\n");
+extern "C" const unsigned char embedded_network_data[];
+extern "C" const unsigned char embedded_network_end[];
+#endif
 
-    // iterate over all pieces
-    for (int i = 0; i < 64; i++) {
-        if (piece_on_square[i] != -1) {
-            int alternative_position = 63 - (i ^ 7);
-            int alternative_piece = piece_on_square[i] < 6 ? piece_on_square[i] + 6 : piece_on_square[i] - 6;
-            active_features_w.push_back(piece_on_square[i]*64 + i);
-            active_features_b.push_back(alternative_piece*64 + alternative_position);
+// quantized NNUE
+
+void quantize_network(const linear_layer<FEATURE_SIZE, HIDDEN1_SIZE>& layer1, const linear_layer<HIDDEN1_SIZE*2, HIDDEN2_SIZE>& layer2, const linear_layer<HIDDEN2_SIZE, HIDDEN3_SIZE>& layer3, const linear_layer<HIDDEN3_SIZE, NUM_OUTPUT_BUCKETS*OUTPUT_SIZE>& layer4, quantized_network& network) {
+    // convert the float network into the quantized network
+
+    // layer 1 is scaled by QA, so the clipped range [0, 1] becomes [0, QA]
+    for (int i = 0; i < FEATURE_SIZE; i++) {
+        for (int j = 0; j < HIDDEN1_SIZE; j++) {
+            float w = std::round(layer1.weights[i][j] * QA);
+            network.layer1.weights[i][j] = static_cast<int16_t>(std::clamp(w, -32767.0f, 32767.0f));
+        }
+    }
+    for (int j = 0; j < HIDDEN1_SIZE; j++) {
+        float b = std::round(layer1.biases[j] * QA);
+        network.layer1.biases[j] = static_cast<int16_t>(std::clamp(b, -32767.0f, 32767.0f));
+    }
+
+    quantize_layer(layer2, network.layer2);
+    quantize_layer(layer3, network.layer3);
+    quantize_layer(layer4, network.layer4);
+}
+
+// Compute quantized accumulator from scratch
+void refresh_accumulator(const quantized_feature_transformer& layer1, quantized_accumulator& accumulator, const std::vector<int>& active_features_w, const std::vector<int>& active_features_b) {
+
+    // start from the biases and add the weights of all active features
+    const int16_t* input[2] = {layer1.biases.data(), layer1.biases.data()};
+    int16_t* output[2] = {accumulator[0], accumulator[1]};
+    feature_list removed[2] = {feature_list(nullptr, 0), feature_list(nullptr, 0)};
+    feature_list added[2] = {active_features_w, active_features_b};
+    active_kernels->update_accumulator(layer1, input, output, removed, added);
+}
+
+// Update the quantized accumulator
+void update_accumulator(const quantized_feature_transformer& layer1, quantized_accumulator& accumulator,
+    const std::vector<int>& removed_features_w, const std::vector<int>& added_features_w,
+    const std::vector<int>& removed_features_b, const std::vector<int>& added_features_b) {
+
+    // in place update of both perspectives
+    const int16_t* input[2] = {accumulator[0], accumulator[1]};
+    int16_t* output[2] = {accumulator[0], accumulator[1]};
+    feature_list removed[2] = {removed_features_w, removed_features_b};
+    feature_list added[2] = {added_features_w, added_features_b};
+    active_kernels->update_accumulator(layer1, input, output, removed, added);
+}
+
+// clipped ReLU on int32 layer outputs, also removes the weight scale
+uint8_t* cReLu(int size, uint8_t* output, const int32_t* input, int32_t shift) {
+
+    active_kernels->crelu(size, output, input, shift);
+
+    return output + size;
+}
+
+int nnue_evaluation(quantized_accumulator& accumulator, const quantized_network& network, bool color, int bucket) {
+
+    // separate buffers for activations and layer outputs, because they have different types
+    alignas(64) uint8_t input[2*HIDDEN1_SIZE];
+    alignas(64) int32_t output[HIDDEN2_SIZE];
+
+    // cReLu after accumulator, side to move first
+    // the copy of the accumulator into the input is fused with the cReLu
+    bool stm = color;
+    active_kernels->crelu_accumulator(accumulator[stm], accumulator[!stm], input);
+
+    // linear layer 2 and cReLu
+    linear_layer_forward(network.layer2, output, input);
+    cReLu(HIDDEN2_SIZE, input, output, network.layer2.shift);
+
+    // linear layer 3 and cReLu
+    linear_layer_forward(network.layer3, output, input);
+    cReLu(HIDDEN3_SIZE, input, output, network.layer3.shift);
+
+    // linear layer 4, only the head of the output bucket
+    const auto& layer4 = network.layer4;
+    active_kernels->affine(layer4.weights[bucket*OUTPUT_SIZE].data(), layer4.biases.data() + bucket*OUTPUT_SIZE, HIDDEN3_SIZE, OUTPUT_SIZE, output, input);
+
+    // remove both the weight scale and the activation scale
+    return descale(output[0], network.layer4.shift) / QA;
+}
+
+
+// batch evaluation
+
+// buffers for one block of positions, one set per thread
+struct batch_buffers {
+    std::array<quantized_accumulator, BATCH_BLOCK_SIZE> accumulators;
+    alignas(64) std::array<uint8_t, BATCH_BLOCK_SIZE*2*HIDDEN1_SIZE> input1;
+    alignas(64) std::array<int32_t, BATCH_BLOCK_SIZE*HIDDEN2_SIZE> output2;
+    alignas(64) std::array<uint8_t, BATCH_BLOCK_SIZE*HIDDEN2_SIZE> input2;
+    alignas(64) std::array<int32_t, BATCH_BLOCK_SIZE*HIDDEN3_SIZE> output3;
+    alignas(64) std::array<uint8_t, BATCH_BLOCK_SIZE*HIDDEN3_SIZE> input3;
+    alignas(64) std::array<int32_t, BATCH_BLOCK_SIZE*NUM_OUTPUT_BUCKETS*OUTPUT_SIZE> output4;
+};
+
+// same arithmetic as nnue_evaluation, so the scores are identical
+static void evaluate_block(const quantized_network& network, const nnue_position* positions, int* scores, int block_size, batch_buffers& buffers) {
+
+    // accumulators from scratch, the active features come straight from the bitboards
+    for (int b = 0; b < block_size; b++) {
+        const std::array<U64, 12>& piece_bitboards = positions[b].piece_bitboards;
+        std::array<std::array<int, 32>, 2> active_features;
+        std::array<int, 2> keys = {
+            king_key(__builtin_ctzll(piece_bitboards[5]), false),
+            king_key(__builtin_ctzll(piece_bitboards[11]), true)
+        };
+        int num_active = 0;
+        for (int i = 0; i < 12; i++) {
+            U64 bitboard = piece_bitboards[i];
+            while (bitboard && num_active < 32) {
+                int square = __builtin_ctzll(bitboard);
+                active_features[0][num_active] = feature_index(i, square, false, keys[0]);
+                active_features[1][num_active] = feature_index(i, square, true, keys[1]);
+                num_active++;
+                bitboard &= bitboard - 1;
+            }
+        }
+
+        quantized_accumulator& accumulator = buffers.accumulators[b];
+        const int16_t* input[2] = {network.layer1.biases.data(), network.layer1.biases.data()};
+        int16_t* output[2] = {accumulator[0], accumulator[1]};
+        feature_list removed[2] = {feature_list(nullptr, 0), feature_list(nullptr, 0)};
+        feature_list added[2] = {feature_list(active_features[0].data(), num_active), feature_list(active_features[1].data(), num_active)};
+        active_kernels->update_accumulator(network.layer1, input, output, removed, added);
+
+        bool stm = positions[b].color;
+        active_kernels->crelu_accumulator(accumulator[stm], accumulator[!stm], buffers.input1.data() + b*2*HIDDEN1_SIZE);
+    }
+
+    // layer 2 stays sparse, the non-zero inputs are different for every position
+    for (int b = 0; b < block_size; b++) {
+        linear_layer_forward(network.layer2, buffers.output2.data() + b*HIDDEN2_SIZE, buffers.input1.data() + b*2*HIDDEN1_SIZE);
+    }
+    cReLu(block_size*HIDDEN2_SIZE, buffers.input2.data(), buffers.output2.data(), network.layer2.shift);
+
+    // layer 3 and 4 as matrix-matrix products, all output heads are computed
+    active_kernels->affine_batch(network.layer3.weights[0].data(), network.layer3.biases.data(), HIDDEN2_SIZE, HIDDEN3_SIZE, block_size, buffers.output3.data(), buffers.input2.data());
+    cReLu(block_size*HIDDEN3_SIZE, buffers.input3.data(), buffers.output3.data(), network.layer3.shift);
+
+    constexpr int NUM_HEADS = NUM_OUTPUT_BUCKETS*OUTPUT_SIZE;
+    active_kernels->affine_batch(network.layer4.weights[0].data(), network.layer4.biases.data(), HIDDEN3_SIZE, NUM_HEADS, block_size, buffers.output4.data(), buffers.input3.data());
+
+    for (int b = 0; b < block_size; b++) {
+        U64 occupancy = 0;
+        for (U64 bitboard : positions[b].piece_bitboards) {
+            occupancy |= bitboard;
         }
+        int bucket = output_bucket(__builtin_popcountll(occupancy));
+        scores[b] = descale(buffers.output4[b*NUM_HEADS + bucket*OUTPUT_SIZE], network.layer4.shift) / QA;
     }
 }
 
-// Compute accumulator from scratch
-void refresh_accumulator(const linear_layer<INPUT_SIZE, HIDDEN1_SIZE>& layer1, NNUE_accumulator& accumulator, const std::vector<int>& active_features, bool color) {
-    
-    // add the biases to the accumulator
-    for (int i = 0; i < HIDDEN1_SIZE; i++) {
-        accumulator.values[color][i] = layer1.biases[i];
+void nnue_evaluate_batch(const quantized_network& network, const nnue_position* positions, int* scores, size_t count, int num_threads) {
+
+    if (num_threads <= 0) {
+        num_threads = std::max(1u, std::thread::hardware_concurrency());
     }
 
-    // add the weights of active features to the accumulator
-    // because features are binary, we can just add the weights of the active features without multiplying
-    for (int af : active_features) {
-        for (int i = 0; i < HIDDEN1_SIZE; i++) {
-            accumulator.values[color][i] += layer1.weights[af][i];
+    // every thread takes every num_threads-th block
+    size_t num_blocks = (count + BATCH_BLOCK_SIZE - 1) / BATCH_BLOCK_SIZE;
+    auto worker = [&](int thread_index) {
+        // vector to put it on the heap
+        std::vector<batch_buffers> buffers(1);
+        for (size_t block = thread_index; block < num_blocks; block += num_threads) {
+            size_t first = block*BATCH_BLOCK_SIZE;
+            int block_size = static_cast<int>(std::min<size_t>(BATCH_BLOCK_SIZE, count - first));
+            evaluate_block(network, positions + first, scores + first, block_size, buffers[0]);
         }
+    };
+
+    std::vector<std::thread> threads;
+    for (int t = 1; t < num_threads; t++) {
+        threads.emplace_back(worker, t);
+    }
+    worker(0);
+    for (std::thread& thread : threads) {
+        thread.join();
     }
 }
 
-// Update the accumulator
-void update_accumulator(const linear_layer<INPUT_SIZE, HIDDEN1_SIZE>& layer1, NNUE_accumulator& accumulator, const std::vector<int>& removed_features, const std::vector<int>& added_features, bool color) {
 
-    // remove the weights of removed features to the accumulator
-    for (int rf : removed_features) {
-        for (int i = 0; i < HIDDEN1_SIZE; i++) {
-            accumulator.values[color][i] -= layer1.weights[rf][i];
+// lazy accumulator stack
+
+// does a perspective have to be refreshed because its king changed key in this ply
+static bool needs_refresh(const accumulator_entry& entry, bool perspective) {
+    int king_index = perspective ? 11 : 5;
+    for (int d = 0; d < entry.num_dirty; d++) {
+        const dirty_piece& dp = entry.dirty_pieces[d];
+        if (dp.piece_index == king_index && king_key(dp.from, perspective) != king_key(dp.to, perspective)) {
+            return true;
         }
     }
-    
-    // add the weights of active features to the accumulator
-    for (int af : added_features) {
-        for (int i = 0; i < HIDDEN1_SIZE; i++) {
-            accumulator.values[color][i] += layer1.weights[af][i];
+    return false;
+}
+
+// compute one perspective of an accumulator from the refresh cache
+static void refresh_from_cache(const quantized_feature_transformer& layer1, accumulator_stack& accumulators, quantized_accumulator& accumulator, const std::array<U64, 12>& piece_bitboards, bool perspective) {
+
+    int king_square = __builtin_ctzll(piece_bitboards[perspective ? 11 : 5]);
+    int key = king_key(king_square, perspective);
+    refresh_cache_entry& entry = accumulators.cache[perspective][key];
+
+    // difference between the cached position and the current position, at most 32 pieces each
+    std::array<int, 32> removed_features;
+    std::array<int, 32> added_features;
+    int num_removed = 0;
+    int num_added = 0;
+    for (int i = 0; i < 12; i++) {
+        U64 removed_bitboard = entry.piece_bitboards[i] & ~piece_bitboards[i];
+        U64 added_bitboard = piece_bitboards[i] & ~entry.piece_bitboards[i];
+        while (removed_bitboard) {
+            removed_features[num_removed++] = feature_index(i, __builtin_ctzll(removed_bitboard), perspective, key);
+            removed_bitboard &= removed_bitboard - 1;
+        }
+        while (added_bitboard) {
+            added_features[num_added++] = feature_index(i, __builtin_ctzll(added_bitboard), perspective, key);
+            added_bitboard &= added_bitboard - 1;
         }
     }
+    entry.piece_bitboards = piece_bitboards;
+
+    // update the cache entry in place, then copy it into the accumulator
+    const int16_t* input[2] = {entry.accumulation.data(), entry.accumulation.data()};
+    int16_t* output[2] = {nullptr, nullptr};
+    output[perspective] = entry.accumulation.data();
+    feature_list removed[2] = {feature_list(removed_features.data(), num_removed), feature_list(removed_features.data(), num_removed)};
+    feature_list added[2] = {feature_list(added_features.data(), num_added), feature_list(added_features.data(), num_added)};
+    active_kernels->update_accumulator(layer1, input, output, removed, added);
+
+    std::copy(entry.accumulation.begin(), entry.accumulation.end(), accumulator[perspective]);
 }
 
-// clipped ReLU activation function
-float* cReLu(int size, float* output, const float* input) {
-    
-    // apply clipped ReLU activation function
-    for (int i = 0; i < size; i++) {
-        output[i] = std::min(std::max(0.0f, input[i]), 1.0f);
+void reset_accumulator_stack(const quantized_feature_transformer& layer1, accumulator_stack& accumulators, const std::array<U64, 12>& piece_bitboards) {
+
+    // empty cache entries, every piece on the board is added on the first refresh
+    for (auto& perspective_entries : accumulators.cache) {
+        for (refresh_cache_entry& entry : perspective_entries) {
+            entry.accumulation = layer1.biases;
+            entry.piece_bitboards.fill(0);
+        }
     }
 
-    return output + size;
+    accumulators.current = 0;
+    accumulator_entry& bottom = accumulators.entries[0];
+    bottom.num_dirty = 0;
+    refresh_from_cache(layer1, accumulators, bottom.accumulator, piece_bitboards, false);
+    refresh_from_cache(layer1, accumulators, bottom.accumulator, piece_bitboards, true);
+    bottom.computed = {true, true};
 }
 
-float nnue_evaluation(NNUE_accumulator& accumulator, const linear_layer<HIDDEN1_SIZE*2, HIDDEN2_SIZE>& layer2, const linear_layer<HIDDEN2_SIZE, HIDDEN3_SIZE>& layer3, const linear_layer<HIDDEN3_SIZE, OUTPUT_SIZE>& layer4, bool color) {
+void collapse_accumulator_stack(const quantized_feature_transformer& layer1, accumulator_stack& accumulators, const std::array<U64, 12>& piece_bitboards) {
 
-    // create a buffer that can fit the largest layer twice
-    // so it needs to be max(HIDDEN1_SIZE, HIDDEN2_SIZE, OUTPUT_SIZE) × 2
-    // this is faster than std::vector because it presents dynamic allocation overhead
-    float buffer[2048];
+    materialize_accumulator(layer1, accumulators, piece_bitboards);
 
-    std::array<float, 2*HIDDEN1_SIZE> input;
-    bool stm = color;
-    for (int i = 0; i < HIDDEN1_SIZE; ++i) {
-        input[i] = accumulator[stm][i];
-        input[HIDDEN1_SIZE + i] = accumulator[!stm][i];
+    if (accumulators.current > 0) {
+        accumulators.entries[0].accumulator = accumulators.entries[accumulators.current].accumulator;
+        accumulators.current = 0;
+    }
+    accumulators.entries[0].num_dirty = 0;
+}
+
+void materialize_accumulator(const quantized_feature_transformer& layer1, accumulator_stack& accumulators, const std::array<U64, 12>& piece_bitboards) {
+
+    accumulator_entry& top = accumulators.entries[accumulators.current];
+
+    // per perspective, find the nearest computed ancestor, the bottom of the stack is always computed
+    // a ply where the king of the perspective changed key cannot be replayed, the refresh cache is used instead
+    std::array<int, 2> first;
+    for (int perspective = 0; perspective < 2; perspective++) {
+        int i = accumulators.current;
+        while (!accumulators.entries[i].computed[perspective] && !needs_refresh(accumulators.entries[i], perspective)) {
+            i--;
+        }
+
+        if (accumulators.entries[i].computed[perspective]) {
+            first[perspective] = i;
+        }
+        else {
+            refresh_from_cache(layer1, accumulators, top.accumulator, piece_bitboards, perspective);
+            top.computed[perspective] = true;
+            first[perspective] = accumulators.current;
+        }
+    }
+
+    // the key of a perspective is the same in every ply that is replayed
+    std::array<int, 2> keys = {
+        king_key(__builtin_ctzll(piece_bitboards[5]), false),
+        king_key(__builtin_ctzll(piece_bitboards[11]), true)
+    };
+
+    // replay the dirty pieces of every ply above it, both perspectives in one pass where possible
+    for (int i = std::min(first[0], first[1]) + 1; i <= accumulators.current; i++) {
+        accumulator_entry& previous = accumulators.entries[i - 1];
+        accumulator_entry& entry = accumulators.entries[i];
+
+        // feature lists for both perspectives, at most 3 removed and 3 added features
+        std::array<std::array<int, 3>, 2> removed_features;
+        std::array<std::array<int, 3>, 2> added_features;
+        int num_removed = 0;
+        int num_added = 0;
+        for (int d = 0; d < entry.num_dirty; d++) {
+            const dirty_piece& dp = entry.dirty_pieces[d];
+            if (dp.from >= 0) {
+                removed_features[0][num_removed] = feature_index(dp.piece_index, dp.from, false, keys[0]);
+                removed_features[1][num_removed] = feature_index(dp.piece_index, dp.from, true, keys[1]);
+                num_removed++;
+            }
+            if (dp.to >= 0) {
+                added_features[0][num_added] = feature_index(dp.piece_index, dp.to, false, keys[0]);
+                added_features[1][num_added] = feature_index(dp.piece_index, dp.to, true, keys[1]);
+                num_added++;
+            }
+        }
+
+        const int16_t* input[2] = {previous.accumulator[0], previous.accumulator[1]};
+        int16_t* output[2] = {nullptr, nullptr};
+        for (int perspective = 0; perspective < 2; perspective++) {
+            if (i > first[perspective]) {
+                output[perspective] = entry.accumulator[perspective];
+                entry.computed[perspective] = true;
+            }
+        }
+        feature_list removed[2] = {feature_list(removed_features[0].data(), num_removed), feature_list(removed_features[1].data(), num_removed)};
+        feature_list added[2] = {feature_list(added_features[0].data(), num_added), feature_list(added_features[1].data(), num_added)};
+        active_kernels->update_accumulator(layer1, input, output, removed, added);
+    }
+}
+
+int nnue_evaluation(accumulator_stack& accumulators, const quantized_network& network, const std::array<U64, 12>& piece_bitboards, bool color) {
+
+    materialize_accumulator(network.layer1, accumulators, piece_bitboards);
+
+    U64 occupancy = 0;
+    for (U64 bitboard : piece_bitboards) {
+        occupancy |= bitboard;
     }
 
-    float* curr_output = buffer;
-    float* curr_input = input.data();
-    float* next_output;
+    return nnue_evaluation(accumulators.entries[accumulators.current].accumulator, network, color, output_bucket(__builtin_popcountll(occupancy)));
+}
 
-    // cReLu after accumulator
-    next_output = cReLu(2*HIDDEN1_SIZE, curr_output, curr_input);
-    curr_input = curr_output;
-    curr_output = next_output;
 
-    // linear layer 2
-    next_output = linear_layer_forward(layer2, curr_output, curr_input);
-    curr_input = curr_output;
-    curr_output = next_output;
+// network files
 
-    // cReLu after layer 2
-    next_output = cReLu(HIDDEN2_SIZE, curr_output, curr_input);
-    curr_input = curr_output;
-    curr_output = next_output;
+// CRC-32 (same polynomial as zlib), used to detect corrupt or truncated network files
+static uint32_t crc32(const unsigned char* data, size_t size) {
 
-    // linear layer 3
-    next_output = linear_layer_forward(layer3, curr_output, curr_input);
-    curr_input = curr_output;
-    curr_output = next_output;
+    static std::array<uint32_t, 256> table = [] {
+        std::array<uint32_t, 256> t;
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++) {
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            }
+            t[i] = c;
+        }
+        return t;
+    }();
 
-    // cReLu after layer 3
-    next_output = cReLu(HIDDEN3_SIZE, curr_output, curr_input);
-    curr_input = curr_output;
-    curr_output = next_output;
+    uint32_t crc = 0xFFFFFFFFu;
+    for (size_t i = 0; i < size; i++) {
+        crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFFu;
+}
 
-    // linear layer 4
-    next_output = linear_layer_forward(layer4, curr_output, curr_input);
+// check the header and return the network inside the buffer, without copying
+const quantized_network* validate_network(const unsigned char* data, size_t size, const std::string& name) {
 
-    return *curr_output;
+    if (size < sizeof(nnue_header)) {
+        throw std::runtime_error(name + ": file too small for a network header");
+    }
+
+    nnue_header header;
+    std::memcpy(&header, data, sizeof(header));
 
-}
\ No newline at end of file
+    if (std::memcmp(header.magic, "YVLN", 4) != 0) {
+        throw std::runtime_error(name + ": not a network file");
+    }
+    if (header.version != NNUE_VERSION) {
+        throw std::runtime_error(name + ": unsupported network version " + std::to_string(header.version));
+    }
+    if (header.input_size != FEATURE_SIZE || header.hidden1_size != HIDDEN1_SIZE || header.hidden2_size != HIDDEN2_SIZE
+        || header.hidden3_size != HIDDEN3_SIZE || header.output_size != OUTPUT_SIZE || header.output_buckets != NUM_OUTPUT_BUCKETS || header.qa != QA) {
+        throw std::runtime_error(name + ": network architecture does not match the engine");
+    }
+    if (header.payload_size != sizeof(quantized_network) || size < sizeof(nnue_header) + sizeof(quantized_network)) {
+        throw std::runtime_error(name + ": unexpected network size");
+    }
+    if (crc32(data + sizeof(nnue_header), header.payload_size) != header.checksum) {
+        throw std::runtime_error(name + ": checksum mismatch");
+    }
+
+    const quantized_network* network = reinterpret_cast<const quantized_network*>(data + sizeof(nnue_header));
+    if (network->layer2.shift != header.shifts[0] || network->layer3.shift != header.shifts[1] || network->layer4.shift != header.shifts[2]) {
+        throw std::runtime_error(name + ": weight shifts do not match the header");
+    }
+
+    return network;
+}
+
+nnue_file load_network(const std::string& path) {
+    // memory map the file, the network is used in place
+
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error(path + ": failed to open network file");
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        throw std::runtime_error(path + ": failed to read network file");
+    }
+
+    size_t size = static_cast<size_t>(st.st_size);
+    void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        throw std::runtime_error(path + ": failed to map network file");
+    }
+
+    nnue_file file;
+    file.mapping = mapping;
+    file.mapping_size = size;
+    file.name = path;
+    try {
+        file.network = validate_network(static_cast<const unsigned char*>(mapping), size, path);
+    }
+    catch (...) {
+        unload_network(file);
+        throw;
+    }
+
+    return file;
+}
+
+nnue_file embedded_network() {
+
+    nnue_file file;
+#ifdef EVALFILE
+    file.name = "<embedded>";
+    size_t size = static_cast<size_t>(embedded_network_end - embedded_network_data);
+    file.network = validate_network(embedded_network_data, size, file.name);
+#endif
+    return file;
+}
+
+void unload_network(nnue_file& file) {
+
+    if (file.mapping) {
+        munmap(file.mapping, file.mapping_size);
+    }
+    file = nnue_file();
+}
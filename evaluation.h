@@ -3,20 +3,21 @@
 #include <random>
 #include <algorithm>
 #include <vector>
-#include <fstream>
+#include <cstdint>
+#include <cmath>
+#include <string>
 
-// start with a very basic NNUE implementation
-// this is a simple feedforward neural network with 3 layers
+using U64 = unsigned long long;
+
+// NNUE, a feedforward neural network with 4 layers
 // Layer 1: 768 → 2*512
 // Layer 2: 1024 → 64
 // Layer 3: 64 → 16
 // Layer 4: 16 → 1
 // The input is a sparse vector of size 768 (0 or 1 values)
 // The output is a single value (the evaluation of the position)
-// The weights and biases are initialized randomly
 // The activation function is clipped ReLU (Rectified Linear Unit)
-// The forward pass is implemented as a series of matrix multiplications
-// and element-wise operations
+// The network is trained in floating point and only runs quantized in the engine
 
 constexpr size_t INPUT_SIZE = 768;
 constexpr size_t HIDDEN1_SIZE = 512;
@@ -24,17 +25,53 @@ constexpr size_t HIDDEN2_SIZE = 64;
 constexpr size_t HIDDEN3_SIZE = 16;
 constexpr size_t OUTPUT_SIZE = 1;
 
-// define NNUE components
+// material output buckets
+// the last layer has a separate head for every bucket, selected by the number of pieces on the board
+// only the head of the current bucket is computed, so more buckets cost nothing at inference time
+constexpr int NUM_OUTPUT_BUCKETS = 8;
 
-// The accumulator is the *output* of the first hidden layer, it is what gets efficiently updated
-struct NNUE_accumulator {
-    std::array<std::array<float, HIDDEN1_SIZE>, 2> values;
+inline int output_bucket(int piece_count) {
+    return std::min((piece_count - 2) / (32 / NUM_OUTPUT_BUCKETS), NUM_OUTPUT_BUCKETS - 1);
+}
 
-    float* operator[](bool color) {
-        return values[color].data();
-    }
+// king buckets (HalfKA)
+// every perspective gets a separate set of the 768 piece-square features for each bucket of its own king
+// the board is mirrored horizontally when the king is on files e-h, so buckets only cover files a-d
+// build with -DKING_BUCKETS to enable them, the network file has to be trained with the same feature set
+#ifdef KING_BUCKETS
+constexpr int NUM_KING_BUCKETS = 8;
+#else
+constexpr int NUM_KING_BUCKETS = 1;
+#endif
+constexpr size_t FEATURE_SIZE = NUM_KING_BUCKETS * INPUT_SIZE;
+
+// king bucket of every square, seen from the perspective of the king's own side
+// symmetric, because the right half of the board is mirrored onto the left half
+constexpr std::array<int, 64> KING_BUCKET_TABLE = {
+    0, 1, 2, 3, 3, 2, 1, 0,
+    4, 4, 5, 5, 5, 5, 4, 4,
+    6, 6, 6, 6, 6, 6, 6, 6,
+    6, 6, 6, 6, 6, 6, 6, 6,
+    7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7,
 };
 
+// bucket and mirroring of a perspective, as king_bucket*2 + mirrored
+// the features of a perspective only change completely when its king changes key
+constexpr int NUM_KING_KEYS = NUM_KING_BUCKETS == 1 ? 1 : 2*NUM_KING_BUCKETS;
+
+inline int king_key(int king_square, bool perspective) {
+    if (NUM_KING_BUCKETS == 1) {
+        return 0;
+    }
+    int square = perspective ? king_square ^ 56 : king_square;
+    return KING_BUCKET_TABLE[square]*2 + ((square & 7) >= 4);
+}
+
+// float network, as trained
+// only used as the input of quantize_network
 // Linear layers have weights and biases
 template <size_t input_size, size_t output_size>
 struct linear_layer {
@@ -42,49 +79,325 @@ struct linear_layer {
     std::array<float, output_size> biases;
 };
 
-// data loader for linear layers
+// quantized NNUE
+// the float network is converted into an integer network for inference
+// Layer 1: int16 weights and biases, int16 accumulator, scaled by QA
+// Layer 2-4: int8 weights, int32 biases, int32 accumulation, scaled by QA * 2^shift
+// the activations between layers are uint8 values in [0, QA], representing [0, 1]
+// only integer arithmetic is used, so scores are identical on every machine
+
+constexpr int QA = 127;
+constexpr int MAX_WEIGHT_SHIFT = 6;
+constexpr int MIN_WEIGHT_SHIFT = -8;
+
+// quantized accumulator
+// The accumulator is the *output* of the first hidden layer, it is what gets efficiently updated
+struct alignas(64) quantized_accumulator {
+    std::array<std::array<int16_t, HIDDEN1_SIZE>, 2> values;
+
+    int16_t* operator[](bool color) {
+        return values[color].data();
+    }
+};
+
+// quantized first layer (feature transformer)
+struct quantized_feature_transformer {
+    alignas(64) std::array<std::array<int16_t, HIDDEN1_SIZE>, FEATURE_SIZE> weights;
+    alignas(64) std::array<int16_t, HIDDEN1_SIZE> biases;
+};
+
+// quantized linear layer
+// !! weights are stored output-major, so every output is a contiguous dot product !!
 template <size_t input_size, size_t output_size>
-void load_layer(linear_layer<input_size, output_size>& layer, const std::string& weights_file, const std::string& biases_file) {
-    std::ifstream w_file(weights_file), b_file(biases_file);
+struct quantized_linear_layer {
+    alignas(64) std::array<std::array<int8_t, input_size>, output_size> weights;
+    alignas(64) std::array<int32_t, output_size> biases;
+    int32_t shift; // weights are scaled by 2^shift
+};
+
+// quantized linear layer for sparse inputs
+// most inputs after the accumulator cReLu are zero, so only the weights of non-zero inputs are used
+// !! weights are stored in blocks of 4 inputs: weights[i/4][j][i%4] !!
+// a non-zero block of 4 inputs then adds one contiguous block of weights to all outputs
+template <size_t input_size, size_t output_size>
+struct quantized_sparse_layer {
+    alignas(64) std::array<std::array<std::array<int8_t, 4>, output_size>, input_size/4> weights;
+    alignas(64) std::array<int32_t, output_size> biases;
+    int32_t shift; // weights are scaled by 2^shift
+};
+
+// complete quantized network, too large for the stack
+struct quantized_network {
+    quantized_feature_transformer layer1;
+    quantized_sparse_layer<HIDDEN1_SIZE*2, HIDDEN2_SIZE> layer2;
+    quantized_linear_layer<HIDDEN2_SIZE, HIDDEN3_SIZE> layer3;
+    quantized_linear_layer<HIDDEN3_SIZE, NUM_OUTPUT_BUCKETS*OUTPUT_SIZE> layer4;
+};
+
+// binary network file (.nnue)
+// a 64 byte header followed by the exact memory image of quantized_network (little endian)
+// the payload starts 64 byte aligned, so a memory mapped file can be used without copying
+// every alignas(64) member starts on a 64 byte boundary, every struct is padded to 64 bytes
+// the exporter in NNUE_training/nnue_training.ipynb writes this layout
 
-    // !! FIRST ITERATE OVER OUTPUT SIZE !!
-    for (int i = 0; i < output_size; i++) {
-        for (int j = 0; j < input_size; j++) {
-            w_file >> layer.weights[j][i];
+constexpr uint32_t NNUE_VERSION = 3;
+
+struct nnue_header {
+    char magic[4];          // "YVLN"
+    uint32_t version;
+    uint32_t input_size;
+    uint32_t hidden1_size;
+    uint32_t hidden2_size;
+    uint32_t hidden3_size;
+    uint32_t output_size;   // per output bucket
+    uint32_t output_buckets;
+    int32_t qa;
+    int32_t shifts[3];      // weight shifts of layer 2-4
+    uint32_t payload_size;
+    uint32_t checksum;      // CRC-32 of the payload
+    uint32_t reserved[2];
+};
+
+static_assert(sizeof(nnue_header) == 64, "the payload has to start 64 byte aligned");
+
+// a loaded network, either memory mapped from a file or embedded in the executable
+struct nnue_file {
+    const quantized_network* network = nullptr;
+    void* mapping = nullptr;    // nullptr for the embedded network
+    size_t mapping_size = 0;
+    std::string name;
+};
+
+// these throw std::runtime_error when the file is missing or does not match the engine
+nnue_file load_network(const std::string& path);
+nnue_file embedded_network();   // network is nullptr when the engine was built without one
+void unload_network(nnue_file& file);
+
+// remove the 2^shift weight scale from an int32 layer output
+inline int32_t descale(int32_t value, int32_t shift) {
+    return shift >= 0 ? value >> shift : value * (1 << -shift);
+}
+
+// quantizer for linear layers
+// the largest shift that keeps every weight inside the int8 range is used
+template <size_t input_size, size_t output_size>
+void quantize_layer(const linear_layer<input_size, output_size>& layer, quantized_linear_layer<input_size, output_size>& q_layer) {
+
+    float max_weight = 0.0f;
+    for (int i = 0; i < input_size; i++) {
+        for (int j = 0; j < output_size; j++) {
+            max_weight = std::max(max_weight, std::abs(layer.weights[i][j]));
         }
     }
 
-    for (int i = 0; i < output_size; i++) {
-        b_file >> layer.biases[i];
+    int shift = MAX_WEIGHT_SHIFT;
+    while (shift > MIN_WEIGHT_SHIFT && max_weight * std::ldexp(1.0f, shift) > 127.0f) {
+        shift--;
     }
-}
+    q_layer.shift = shift;
 
-// input functions
-void game_state_to_input(const std::array<int, 64>& piece_on_square, std::vector<int>& active_features_w, std::vector<int>& active_features_b);
-void refresh_accumulator(const linear_layer<INPUT_SIZE, HIDDEN1_SIZE>& layer1, NNUE_accumulator& accumulator, const std::vector<int>& active_features, bool color);
-void update_accumulator(const linear_layer<INPUT_SIZE, HIDDEN1_SIZE>& layer1, NNUE_accumulator& accumulator, const std::vector<int>& removed_features, const std::vector<int>& added_features, bool color);
+    // transpose to output-major while quantizing
+    float weight_scale = std::ldexp(1.0f, shift);
+    for (int i = 0; i < input_size; i++) {
+        for (int j = 0; j < output_size; j++) {
+            float w = std::round(layer.weights[i][j] * weight_scale);
+            q_layer.weights[j][i] = static_cast<int8_t>(std::clamp(w, -127.0f, 127.0f));
+        }
+    }
 
-// linear layer forward pass
-template <size_t input_size, size_t output_size>
-float* linear_layer_forward(const linear_layer<input_size, output_size>& layer, float* output, const float* input) {
-    
-    // copy biases to output
-    for (int i = 0; i < output_size; i++) {
-        output[i] = layer.biases[i];
+    for (int j = 0; j < output_size; j++) {
+        q_layer.biases[j] = static_cast<int32_t>(std::round(layer.biases[j] * QA * weight_scale));
     }
+}
+
+// quantizer for sparse layers, same quantization as a dense layer in the blocked layout
+template <size_t input_size, size_t output_size>
+void quantize_layer(const linear_layer<input_size, output_size>& layer, quantized_sparse_layer<input_size, output_size>& q_layer) {
+
+    // vector to put it on the heap
+    std::vector<quantized_linear_layer<input_size, output_size>> dense(1);
+    quantize_layer(layer, dense[0]);
 
-    // multiply input by weights and add to output
     for (int i = 0; i < input_size; i++) {
         for (int j = 0; j < output_size; j++) {
-            output[j] += layer.weights[i][j] * input[i];
+            q_layer.weights[i/4][j][i%4] = dense[0].weights[j][i];
         }
     }
+    q_layer.biases = dense[0].biases;
+    q_layer.shift = dense[0].shift;
+}
+
+void quantize_network(const linear_layer<FEATURE_SIZE, HIDDEN1_SIZE>& layer1, const linear_layer<HIDDEN1_SIZE*2, HIDDEN2_SIZE>& layer2, const linear_layer<HIDDEN2_SIZE, HIDDEN3_SIZE>& layer3, const linear_layer<HIDDEN3_SIZE, NUM_OUTPUT_BUCKETS*OUTPUT_SIZE>& layer4, quantized_network& network);
+
+// SIMD kernels
+// every instruction set implements the same kernels (see evaluation_simd.cpp)
+// the best set supported by the CPU is selected at startup, with a scalar fallback
+
+// list of feature indices, without ownership
+struct feature_list {
+    const int* features;
+    int size;
+
+    feature_list(const std::vector<int>& v) : features(v.data()), size(static_cast<int>(v.size())) {}
+    feature_list(const int* f, int s) : features(f), size(s) {}
+};
+
+struct simd_kernels {
+    const char* name;
+
+    // output[c] = input[c] - removed[c] + added[c] for both perspectives in one pass
+    // input and output may be the same accumulator, a perspective with a nullptr output is skipped
+    void (*update_accumulator)(const quantized_feature_transformer& layer1, const int16_t* const input[2], int16_t* const output[2], const feature_list removed[2], const feature_list added[2]);
+
+    // clipped ReLU of both accumulator halves, written directly into the layer 2 input
+    void (*crelu_accumulator)(const int16_t* us, const int16_t* them, uint8_t* output);
+
+    // clipped ReLU of int32 layer outputs, removes the 2^shift weight scale
+    void (*crelu)(int size, uint8_t* output, const int32_t* input, int32_t shift);
+
+    // dense int8 layer with output-major weights
+    void (*affine)(const int8_t* weights, const int32_t* biases, int input_size, int output_size, int32_t* output, const uint8_t* input);
+
+    // int8 layer with HIDDEN2_SIZE outputs and weights in blocks of 4 inputs, skips zero input blocks
+    void (*sparse_affine)(const int8_t* weights, const int32_t* biases, int input_size, int32_t* output, const uint8_t* input);
+
+    // dense int8 layer on a batch of inputs (matrix-matrix product), input[b][i] and output[b][j]
+    void (*affine_batch)(const int8_t* weights, const int32_t* biases, int input_size, int output_size, int batch_size, int32_t* output, const uint8_t* input);
+};
+
+extern const simd_kernels scalar_kernels;
+extern const simd_kernels* active_kernels;
+
+// all kernel sets the current CPU can run, worst to best
+std::vector<const simd_kernels*> supported_kernels();
+const simd_kernels* select_kernels();
+
+// quantized input functions
+// both perspectives are refreshed and updated together
+void refresh_accumulator(const quantized_feature_transformer& layer1, quantized_accumulator& accumulator, const std::vector<int>& active_features_w, const std::vector<int>& active_features_b);
+void update_accumulator(const quantized_feature_transformer& layer1, quantized_accumulator& accumulator,
+    const std::vector<int>& removed_features_w, const std::vector<int>& added_features_w,
+    const std::vector<int>& removed_features_b, const std::vector<int>& added_features_b);
+
+// quantized linear layer forward pass
+template <size_t input_size, size_t output_size>
+int32_t* linear_layer_forward(const quantized_linear_layer<input_size, output_size>& layer, int32_t* output, const uint8_t* input) {
+
+    // int8 * uint8 products are accumulated in int32
+    active_kernels->affine(layer.weights[0].data(), layer.biases.data(), input_size, output_size, output, input);
 
     return output + output_size;
 }
 
-// activation function
-float* cReLu(int size, float* output, const float* input);
+// quantized sparse layer forward pass
+template <size_t input_size, size_t output_size>
+int32_t* linear_layer_forward(const quantized_sparse_layer<input_size, output_size>& layer, int32_t* output, const uint8_t* input) {
+
+    static_assert(output_size == HIDDEN2_SIZE, "the sparse kernels are specialized for layer 2");
+    active_kernels->sparse_affine(layer.weights[0][0].data(), layer.biases.data(), input_size, output, input);
+
+    return output + output_size;
+}
+
+// integer activation function
+uint8_t* cReLu(int size, uint8_t* output, const int32_t* input, int32_t shift);
+
+// actual quantized evaluation, in centipawns
+int nnue_evaluation(quantized_accumulator& accumulator, const quantized_network& network, bool color, int bucket);
+
+// batch evaluation
+// scores many independent positions, for data validation and analysis rather than search
+// accumulators are built from scratch for blocks of positions, the dense layers run over a whole block
+// at once so every weight row is loaded once per block, and the blocks are spread over all cores
+
+constexpr int BATCH_BLOCK_SIZE = 64;
+
+struct nnue_position {
+    std::array<U64, 12> piece_bitboards;
+    bool color;     // side to move, scores are from its perspective
+};
+
+// num_threads = 0 uses every core
+void nnue_evaluate_batch(const quantized_network& network, const nnue_position* positions, int* scores, size_t count, int num_threads = 0);
+
+// lazy accumulator updates
+// apply_move only records the pieces that changed (dirty pieces) on a per-ply stack
+// an accumulator is computed from the nearest computed ancestor when an evaluation needs it
+// nodes that are never evaluated never touch the weights, and undoing a move is a pointer decrement
+
+constexpr int ACCUMULATOR_STACK_SIZE = 258;
+
+// a piece that changed square, a move changes at most 3 pieces (promotion with capture)
+struct dirty_piece {
+    int8_t piece_index;
+    int8_t from;    // -1 when the piece is added
+    int8_t to;      // -1 when the piece is removed
+};
+
+struct accumulator_entry {
+    quantized_accumulator accumulator;
+    std::array<dirty_piece, 3> dirty_pieces;
+    int num_dirty;
+    std::array<bool, 2> computed;   // per perspective
+};
+
+// refresh cache (Finny table)
+// for every perspective and king key, the accumulator of the last position refreshed with that key
+// when a king changes key, only the difference between that position and the current one is applied
+// instead of all pieces on the board
+struct refresh_cache_entry {
+    alignas(64) std::array<int16_t, HIDDEN1_SIZE> accumulation;
+    std::array<U64, 12> piece_bitboards;
+};
+
+using refresh_cache = std::array<std::array<refresh_cache_entry, NUM_KING_KEYS>, 2>;
+
+// one stack per search thread
+struct accumulator_stack {
+    std::array<accumulator_entry, ACCUMULATOR_STACK_SIZE> entries;
+    refresh_cache cache;
+    int current = 0;
+
+    void push() {
+        current++;
+        entries[current].num_dirty = 0;
+        entries[current].computed = {false, false};
+    }
+
+    void pop() {
+        current--;
+    }
+
+    void add_dirty_piece(int piece_index, int from, int to) {
+        accumulator_entry& entry = entries[current];
+        entry.dirty_pieces[entry.num_dirty] = {static_cast<int8_t>(piece_index), static_cast<int8_t>(from), static_cast<int8_t>(to)};
+        entry.num_dirty++;
+    }
+};
+
+// feature index of a piece on a square, seen from white (false) or black (true)
+// key is the king key of that perspective
+inline int feature_index(int piece_index, int square, bool perspective, int key) {
+    if (perspective) {
+        piece_index = piece_index < 6 ? piece_index + 6 : piece_index - 6;
+        square ^= 56;
+    }
+    if (key & 1) {
+        square ^= 7;
+    }
+    return (key >> 1)*INPUT_SIZE + piece_index*64 + square;
+}
+
+// compute the bottom of the stack from the piece bitboards and drop everything above it
+// this also clears the refresh cache, which is needed after loading another network
+void reset_accumulator_stack(const quantized_feature_transformer& layer1, accumulator_stack& accumulators, const std::array<U64, 12>& piece_bitboards);
+
+// make the accumulator on top of the stack the new bottom of the stack
+void collapse_accumulator_stack(const quantized_feature_transformer& layer1, accumulator_stack& accumulators, const std::array<U64, 12>& piece_bitboards);
+
+// make sure the accumulator on top of the stack is computed
+// the piece bitboards of the current position are needed when a king changed key
+void materialize_accumulator(const quantized_feature_transformer& layer1, accumulator_stack& accumulators, const std::array<U64, 12>& piece_bitboards);
 
-// actual evaluation
-float nnue_evaluation(NNUE_accumulator& accumulator, const linear_layer<HIDDEN1_SIZE*2, HIDDEN2_SIZE>& layer2, const linear_layer<HIDDEN2_SIZE, HIDDEN3_SIZE>& layer3, const linear_layer<HIDDEN3_SIZE, OUTPUT_SIZE>& layer4, bool color);
\ No newline at end of file
+// evaluation of the position on top of the stack
+int nnue_evaluation(accumulator_stack& accumulators, const quantized_network& network, const std::array<U64, 12>& piece_bitboards, bool color);
@@ -0,0 +1,322 @@
+#include "evaluation.h"
+#include <immintrin.h>
+#include <cstring>
+
+// SIMD kernels for the quantized NNUE
+// each instruction set gets its own namespace, compiled for that target only
+// the generic kernel code lives in evaluation_simd.inc, the namespaces only provide the vector helpers
+// this keeps a single binary that runs on every x86-64 CPU
+
+#define SIMD_PRAGMA(x) _Pragma(#x)
+#if defined(__clang__)
+#define SIMD_TARGET_BEGIN(isa) SIMD_PRAGMA(clang attribute push(__attribute__((target(isa))), apply_to = function))
+#define SIMD_TARGET_END SIMD_PRAGMA(clang attribute pop)
+#else
+#define SIMD_TARGET_BEGIN(isa) SIMD_PRAGMA(GCC push_options) SIMD_PRAGMA(GCC target(isa))
+#define SIMD_TARGET_END SIMD_PRAGMA(GCC pop_options)
+#endif
+
+// scalar fallback
+namespace scalar {
+
+void update_accumulator(const quantized_feature_transformer& layer1, const int16_t* const input[2], int16_t* const output[2], const feature_list removed[2], const feature_list added[2]) {
+    for (int color = 0; color < 2; color++) {
+        if (!output[color]) {
+            continue;
+        }
+        for (int i = 0; i < HIDDEN1_SIZE; i++) {
+            output[color][i] = input[color][i];
+        }
+        for (int f = 0; f < removed[color].size; f++) {
+            for (int i = 0; i < HIDDEN1_SIZE; i++) {
+                output[color][i] -= layer1.weights[removed[color].features[f]][i];
+            }
+        }
+        for (int f = 0; f < added[color].size; f++) {
+            for (int i = 0; i < HIDDEN1_SIZE; i++) {
+                output[color][i] += layer1.weights[added[color].features[f]][i];
+            }
+        }
+    }
+}
+
+void crelu_accumulator(const int16_t* us, const int16_t* them, uint8_t* output) {
+    for (int i = 0; i < HIDDEN1_SIZE; i++) {
+        output[i] = static_cast<uint8_t>(std::clamp<int>(us[i], 0, QA));
+        output[HIDDEN1_SIZE + i] = static_cast<uint8_t>(std::clamp<int>(them[i], 0, QA));
+    }
+}
+
+void crelu(int size, uint8_t* output, const int32_t* input, int32_t shift) {
+    for (int i = 0; i < size; i++) {
+        output[i] = static_cast<uint8_t>(std::clamp<int32_t>(descale(input[i], shift), 0, QA));
+    }
+}
+
+void affine(const int8_t* weights, const int32_t* biases, int input_size, int output_size, int32_t* output, const uint8_t* input) {
+    for (int j = 0; j < output_size; j++) {
+        int32_t sum = biases[j];
+        for (int i = 0; i < input_size; i++) {
+            sum += weights[j*input_size + i] * input[i];
+        }
+        output[j] = sum;
+    }
+}
+
+void sparse_affine(const int8_t* weights, const int32_t* biases, int input_size, int32_t* output, const uint8_t* input) {
+    for (int j = 0; j < HIDDEN2_SIZE; j++) {
+        output[j] = biases[j];
+    }
+    for (int block = 0; block < input_size/4; block++) {
+        // skip blocks of 4 zero inputs
+        uint32_t packed;
+        std::memcpy(&packed, input + 4*block, 4);
+        if (!packed) {
+            continue;
+        }
+        const int8_t* column = weights + block*HIDDEN2_SIZE*4;
+        for (int j = 0; j < HIDDEN2_SIZE; j++) {
+            for (int k = 0; k < 4; k++) {
+                output[j] += column[j*4 + k] * input[4*block + k];
+            }
+        }
+    }
+}
+
+void affine_batch(const int8_t* weights, const int32_t* biases, int input_size, int output_size, int batch_size, int32_t* output, const uint8_t* input) {
+    for (int b = 0; b < batch_size; b++) {
+        affine(weights, biases, input_size, output_size, output + b*output_size, input + b*input_size);
+    }
+}
+
+}
+
+// SSE4.1
+SIMD_TARGET_BEGIN("sse4.1")
+namespace sse41 {
+
+using vec_t = __m128i;
+constexpr int VEC_SIZE = 16;
+
+inline vec_t vec_load(const void* p) { return _mm_loadu_si128(static_cast<const vec_t*>(p)); }
+inline void vec_store(void* p, vec_t v) { _mm_storeu_si128(static_cast<vec_t*>(p), v); }
+inline vec_t vec_zero() { return _mm_setzero_si128(); }
+inline vec_t vec_add_16(vec_t a, vec_t b) { return _mm_add_epi16(a, b); }
+inline vec_t vec_sub_16(vec_t a, vec_t b) { return _mm_sub_epi16(a, b); }
+
+inline vec_t vec_crelu_16_to_8(vec_t a, vec_t b) {
+    return _mm_min_epu8(_mm_packus_epi16(a, b), _mm_set1_epi8(QA));
+}
+
+inline vec_t vec_crelu_32_to_8(vec_t a, vec_t b, vec_t c, vec_t d, int32_t shift) {
+    vec_t count = _mm_cvtsi32_si128(shift);
+    vec_t ab = _mm_packs_epi32(_mm_sra_epi32(a, count), _mm_sra_epi32(b, count));
+    vec_t cd = _mm_packs_epi32(_mm_sra_epi32(c, count), _mm_sra_epi32(d, count));
+    return _mm_min_epu8(_mm_packus_epi16(ab, cd), _mm_set1_epi8(QA));
+}
+
+inline vec_t vec_dot_u8_i8(vec_t sum, vec_t u8, vec_t i8) {
+    // uint8 values are at most QA, so the int16 pair sums of maddubs can not saturate
+    vec_t products = _mm_madd_epi16(_mm_maddubs_epi16(u8, i8), _mm_set1_epi16(1));
+    return _mm_add_epi32(sum, products);
+}
+
+inline vec_t vec_set1_32(int32_t x) { return _mm_set1_epi32(x); }
+
+inline uint32_t vec_nonzero_mask_32(vec_t v) {
+    return ~_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(v, _mm_setzero_si128()))) & 0xF;
+}
+
+inline int32_t vec_hsum_32(vec_t v) {
+    v = _mm_add_epi32(v, _mm_shuffle_epi32(v, 0x4E));
+    v = _mm_add_epi32(v, _mm_shuffle_epi32(v, 0xB1));
+    return _mm_cvtsi128_si32(v);
+}
+
+#include "evaluation_simd.inc"
+
+}
+SIMD_TARGET_END
+
+// AVX2
+SIMD_TARGET_BEGIN("avx2")
+namespace avx2 {
+
+using vec_t = __m256i;
+constexpr int VEC_SIZE = 32;
+
+inline vec_t vec_load(const void* p) { return _mm256_loadu_si256(static_cast<const vec_t*>(p)); }
+inline void vec_store(void* p, vec_t v) { _mm256_storeu_si256(static_cast<vec_t*>(p), v); }
+inline vec_t vec_zero() { return _mm256_setzero_si256(); }
+inline vec_t vec_add_16(vec_t a, vec_t b) { return _mm256_add_epi16(a, b); }
+inline vec_t vec_sub_16(vec_t a, vec_t b) { return _mm256_sub_epi16(a, b); }
+
+inline vec_t vec_crelu_16_to_8(vec_t a, vec_t b) {
+    // packus works per 128-bit lane, so the 64-bit blocks need to be reordered
+    vec_t packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xD8);
+    return _mm256_min_epu8(packed, _mm256_set1_epi8(QA));
+}
+
+inline vec_t vec_crelu_32_to_8(vec_t a, vec_t b, vec_t c, vec_t d, int32_t shift) {
+    __m128i count = _mm_cvtsi32_si128(shift);
+    vec_t ab = _mm256_packs_epi32(_mm256_sra_epi32(a, count), _mm256_sra_epi32(b, count));
+    vec_t cd = _mm256_packs_epi32(_mm256_sra_epi32(c, count), _mm256_sra_epi32(d, count));
+    vec_t packed = _mm256_packus_epi16(ab, cd);
+    packed = _mm256_permutevar8x32_epi32(packed, _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7));
+    return _mm256_min_epu8(packed, _mm256_set1_epi8(QA));
+}
+
+inline vec_t vec_dot_u8_i8(vec_t sum, vec_t u8, vec_t i8) {
+    vec_t products = _mm256_madd_epi16(_mm256_maddubs_epi16(u8, i8), _mm256_set1_epi16(1));
+    return _mm256_add_epi32(sum, products);
+}
+
+inline vec_t vec_set1_32(int32_t x) { return _mm256_set1_epi32(x); }
+
+inline uint32_t vec_nonzero_mask_32(vec_t v) {
+    return ~_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(v, _mm256_setzero_si256()))) & 0xFF;
+}
+
+inline int32_t vec_hsum_32(vec_t v) {
+    __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0x4E));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0xB1));
+    return _mm_cvtsi128_si32(sum);
+}
+
+#include "evaluation_simd.inc"
+
+}
+SIMD_TARGET_END
+
+// AVX-512, with the byte and word instructions
+SIMD_TARGET_BEGIN("avx512f,avx512bw")
+namespace avx512 {
+
+using vec_t = __m512i;
+constexpr int VEC_SIZE = 64;
+
+inline vec_t vec_load(const void* p) { return _mm512_loadu_si512(p); }
+inline void vec_store(void* p, vec_t v) { _mm512_storeu_si512(p, v); }
+inline vec_t vec_zero() { return _mm512_setzero_si512(); }
+inline vec_t vec_add_16(vec_t a, vec_t b) { return _mm512_add_epi16(a, b); }
+inline vec_t vec_sub_16(vec_t a, vec_t b) { return _mm512_sub_epi16(a, b); }
+
+inline vec_t vec_crelu_16_to_8(vec_t a, vec_t b) {
+    vec_t packed = _mm512_packus_epi16(a, b);
+    packed = _mm512_permutexvar_epi64(_mm512_setr_epi64(0, 2, 4, 6, 1, 3, 5, 7), packed);
+    return _mm512_min_epu8(packed, _mm512_set1_epi8(QA));
+}
+
+inline vec_t vec_crelu_32_to_8(vec_t a, vec_t b, vec_t c, vec_t d, int32_t shift) {
+    __m128i count = _mm_cvtsi32_si128(shift);
+    vec_t ab = _mm512_packs_epi32(_mm512_sra_epi32(a, count), _mm512_sra_epi32(b, count));
+    vec_t cd = _mm512_packs_epi32(_mm512_sra_epi32(c, count), _mm512_sra_epi32(d, count));
+    vec_t packed = _mm512_packus_epi16(ab, cd);
+    packed = _mm512_permutexvar_epi32(_mm512_setr_epi32(0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15), packed);
+    return _mm512_min_epu8(packed, _mm512_set1_epi8(QA));
+}
+
+inline vec_t vec_dot_u8_i8(vec_t sum, vec_t u8, vec_t i8) {
+    vec_t products = _mm512_madd_epi16(_mm512_maddubs_epi16(u8, i8), _mm512_set1_epi16(1));
+    return _mm512_add_epi32(sum, products);
+}
+
+inline vec_t vec_set1_32(int32_t x) { return _mm512_set1_epi32(x); }
+
+inline uint32_t vec_nonzero_mask_32(vec_t v) {
+    return _mm512_test_epi32_mask(v, v);
+}
+
+inline int32_t vec_hsum_32(vec_t v) {
+    return _mm512_reduce_add_epi32(v);
+}
+
+#include "evaluation_simd.inc"
+
+}
+SIMD_TARGET_END
+
+// AVX-512 with VNNI, the dot product becomes a single instruction
+SIMD_TARGET_BEGIN("avx512f,avx512bw,avx512vnni")
+namespace avx512_vnni {
+
+using vec_t = __m512i;
+constexpr int VEC_SIZE = 64;
+
+inline vec_t vec_load(const void* p) { return _mm512_loadu_si512(p); }
+inline void vec_store(void* p, vec_t v) { _mm512_storeu_si512(p, v); }
+inline vec_t vec_zero() { return _mm512_setzero_si512(); }
+inline vec_t vec_add_16(vec_t a, vec_t b) { return _mm512_add_epi16(a, b); }
+inline vec_t vec_sub_16(vec_t a, vec_t b) { return _mm512_sub_epi16(a, b); }
+
+inline vec_t vec_crelu_16_to_8(vec_t a, vec_t b) {
+    vec_t packed = _mm512_packus_epi16(a, b);
+    packed = _mm512_permutexvar_epi64(_mm512_setr_epi64(0, 2, 4, 6, 1, 3, 5, 7), packed);
+    return _mm512_min_epu8(packed, _mm512_set1_epi8(QA));
+}
+
+inline vec_t vec_crelu_32_to_8(vec_t a, vec_t b, vec_t c, vec_t d, int32_t shift) {
+    __m128i count = _mm_cvtsi32_si128(shift);
+    vec_t ab = _mm512_packs_epi32(_mm512_sra_epi32(a, count), _mm512_sra_epi32(b, count));
+    vec_t cd = _mm512_packs_epi32(_mm512_sra_epi32(c, count), _mm512_sra_epi32(d, count));
+    vec_t packed = _mm512_packus_epi16(ab, cd);
+    packed = _mm512_permutexvar_epi32(_mm512_setr_epi32(0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15), packed);
+    return _mm512_min_epu8(packed, _mm512_set1_epi8(QA));
+}
+
+inline vec_t vec_dot_u8_i8(vec_t sum, vec_t u8, vec_t i8) {
+    return _mm512_dpbusd_epi32(sum, u8, i8);
+}
+
+inline vec_t vec_set1_32(int32_t x) { return _mm512_set1_epi32(x); }
+
+inline uint32_t vec_nonzero_mask_32(vec_t v) {
+    return _mm512_test_epi32_mask(v, v);
+}
+
+inline int32_t vec_hsum_32(vec_t v) {
+    return _mm512_reduce_add_epi32(v);
+}
+
+#include "evaluation_simd.inc"
+
+}
+SIMD_TARGET_END
+
+// kernel sets
+
+const simd_kernels scalar_kernels = {"scalar", scalar::update_accumulator, scalar::crelu_accumulator, scalar::crelu, scalar::affine, scalar::sparse_affine, scalar::affine_batch};
+const simd_kernels sse41_kernels = {"sse4.1", sse41::update_accumulator, sse41::crelu_accumulator, sse41::crelu, sse41::affine, sse41::sparse_affine, sse41::affine_batch};
+const simd_kernels avx2_kernels = {"avx2", avx2::update_accumulator, avx2::crelu_accumulator, avx2::crelu, avx2::affine, avx2::sparse_affine, avx2::affine_batch};
+const simd_kernels avx512_kernels = {"avx512", avx512::update_accumulator, avx512::crelu_accumulator, avx512::crelu, avx512::affine, avx512::sparse_affine, avx512::affine_batch};
+const simd_kernels avx512_vnni_kernels = {"avx512-vnni", avx512_vnni::update_accumulator, avx512_vnni::crelu_accumulator, avx512_vnni::crelu, avx512_vnni::affine, avx512_vnni::sparse_affine, avx512_vnni::affine_batch};
+
+std::vector<const simd_kernels*> supported_kernels() {
+    // cpuid based detection, this also checks if the OS saves the wide registers
+
+    __builtin_cpu_init();
+
+    std::vector<const simd_kernels*> kernels = {&scalar_kernels};
+    if (__builtin_cpu_supports("sse4.1")) {
+        kernels.push_back(&sse41_kernels);
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        kernels.push_back(&avx2_kernels);
+    }
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")) {
+        kernels.push_back(&avx512_kernels);
+        if (__builtin_cpu_supports("avx512vnni")) {
+            kernels.push_back(&avx512_vnni_kernels);
+        }
+    }
+
+    return kernels;
+}
+
+const simd_kernels* select_kernels() {
+    return supported_kernels().back();
+}
+
+// selected once at startup
+const simd_kernels* active_kernels = select_kernels();
@@ -1,31 +1,8 @@
-#include "move_generation.h"
+// includes move_generation.h, make/unmake are instantiated for the evaluation policies
+#include "position_evaluation.h"
 
 // usefull functions
 
-U64 combine_white(const std::array<U64, 12>& piece_bitboards) {
-    U64 combined = 0;
-    for (int i = 0; i < 6; i++) {
-        combined |= piece_bitboards[i];
-    }
-    return combined;
-}
-
-U64 combine_black(const std::array<U64, 12>& piece_bitboards) {
-    U64 combined = 0;
-    for (int i = 6; i < 12; i++) {
-        combined |= piece_bitboards[i];
-    }
-    return combined;
-}
-
-U64 get_occupancy(const std::array<U64, 12>& piece_bitboards) {
-    U64 combined = 0;
-    for (int i = 0; i < 12; i++) {
-        combined |= piece_bitboards[i];
-    }
-    return combined;
-}
-
 // this can return a vector, because it only runs on startup
 std::vector<int> get_set_bit_positions(U64 bitboard) {
     // function to get the positions of set bits in a U64 bitboard
@@ -97,53 +74,69 @@ std::vector<U64> get_blocker_boards(int position, U64 mask_bitboard) {
     return blocker_bitboards;
 }
 
-U64 generate_candidate_magic() {
-    // generate a random 64-bit number with a low amount of set bits
-
-    // generate a seed
-    std::random_device rd;
-    std::mt19937_64 rng(rd());
-
-    // initialize the pseudo-random number generator
-    static std::uniform_int_distribution<uint64_t> dist(0, UINT64_MAX);
-
-    // reduce the amount of set bits by combining random numbers
-    return dist(rng) & dist(rng) & dist(rng);
+// magic numbers for an index of exactly the number of mask bits
+// found once with a fixed seed random search, perft checks them
+constexpr std::array<U64, 64> BISHOP_MAGICS = {
+    0x0082500902208200ULL, 0x0202420204010000ULL, 0x1d44881481008000ULL, 0x0114410421000080ULL,
+    0x0c04030840080000ULL, 0x4502080485004200ULL, 0x8040412820108400ULL, 0x28b6005100882028ULL,
+    0x0000108208014412ULL, 0x0000081004004840ULL, 0x0010880800508020ULL, 0x0910840400980022ULL,
+    0x0008011040001005ULL, 0x0000030c06400802ULL, 0x0210052402200400ULL, 0x10400e1504010400ULL,
+    0x2060801821940280ULL, 0x0b60200401120202ULL, 0x8002020400240500ULL, 0x0008040c20232020ULL,
+    0x4102208400a01040ULL, 0x0003080201012042ULL, 0x8202001080842000ULL, 0x8400450211040110ULL,
+    0x0220b10008021800ULL, 0x0092420010042808ULL, 0x0024242428004400ULL, 0x0004040210401080ULL,
+    0x8001001001004008ULL, 0x0010008125044101ULL, 0xe0020040a0880841ULL, 0x046c202400888401ULL,
+    0x400820b500100c80ULL, 0x0200882042880208ULL, 0x0804c03000080048ULL, 0x15001108010c0040ULL,
+    0x8040020200018880ULL, 0x0880d00100208084ULL, 0x0004140080004800ULL, 0x0100820088204400ULL,
+    0x0001011040241000ULL, 0x0061080104001080ULL, 0x0002010341005810ULL, 0x200000c202002020ULL,
+    0x1100220a02010411ULL, 0x0401011003000085ULL, 0x8048020092084400ULL, 0x1810020090280100ULL,
+    0x000400880808250aULL, 0xe280220904202180ULL, 0x0000810241300000ULL, 0x0814045884240104ULL,
+    0x8019012044240000ULL, 0x822042020401006aULL, 0x4040822244111180ULL, 0x08200880a1004020ULL,
+    0x03030400440a1800ULL, 0x4010030065102802ULL, 0x4200480904110400ULL, 0x0011220110420200ULL,
+    0x0001000010a2020aULL, 0x1000216004210210ULL, 0x0000880290020212ULL, 0x0108100100440080ULL
+};
+
+constexpr std::array<U64, 64> ROOK_MAGICS = {
+    0x0080008014244001ULL, 0x2040002000401000ULL, 0x9900084011042001ULL, 0x0c80040801100080ULL,
+    0x0100080010040300ULL, 0x0200020090410408ULL, 0x0200008104020008ULL, 0x9200008104003042ULL,
+    0x9000802080004000ULL, 0x0000400050002000ULL, 0x2202802000801008ULL, 0x4001001000082100ULL,
+    0x0810808008000400ULL, 0x0008808004004200ULL, 0x4083000200010004ULL, 0x0182000084010072ULL,
+    0xc022228000400280ULL, 0x0010004000200040ULL, 0x4020028010008220ULL, 0x8100828010010801ULL,
+    0x0004110008010500ULL, 0x0062010100080400ULL, 0x0041040010086201ULL, 0x0080820004204081ULL,
+    0x2060208080004000ULL, 0x0002400180200080ULL, 0x0001004100200012ULL, 0x8008100100200900ULL,
+    0x00c8000404002040ULL, 0x2000040080020080ULL, 0x910100c100020004ULL, 0x0008802080004100ULL,
+    0x4000804000800020ULL, 0x00c0402002401008ULL, 0x000a048442002010ULL, 0x3030090021001000ULL,
+    0x0048004200400400ULL, 0x0000800400800201ULL, 0x0200825004000108ULL, 0x0401184082000c09ULL,
+    0x1820400080208008ULL, 0x1110002000404000ULL, 0x0490100020008080ULL, 0x4001001000090020ULL,
+    0x0010080011010005ULL, 0x8024001008020200ULL, 0x0060040200010100ULL, 0x34c8008100420034ULL,
+    0x0000800041002100ULL, 0x04402200830a4200ULL, 0x0000104020010100ULL, 0x2048001000840880ULL,
+    0x002c008480880080ULL, 0x8404000480020080ULL, 0x0104880201100400ULL, 0x2048008c00510200ULL,
+    0x0000850040142202ULL, 0x100a010020108042ULL, 0x00200a0010802242ULL, 0x0010100020090501ULL,
+    0x00020028a0106402ULL, 0x0c12001001080482ULL, 0x0100081001008244ULL, 0x0100002680440302ULL
+};
+
+// slider attack backend
+
+bool has_fast_pext() {
+    // pext is microcoded and slow on AMD before Zen 3 (families 15h and 17h)
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("bmi2") && !__builtin_cpu_is("amdfam15h") && !__builtin_cpu_is("amdfam17h");
 }
 
-void generate_magics(int position, U64 mask_bitboard, std::vector<U64> blocker_boards, std::vector<U64> attack_bitboards, U64& candidate_magic, std::array<U64, 262144>& lookup_table) {
-    // generate candidate magic numbers and lookup tables for a given position
-
-    // initialize
-    int index_bits = count_set_bits(mask_bitboard);
-
-    for (int i = 0; i < 100000000; i++) {
-        // generate a candidate magic number
-        candidate_magic = generate_candidate_magic();
+// selected once at startup
+bool use_pext = has_fast_pext();
 
-        // initialize
-        bool valid = true;
+void fill_slider_table(lookup_tables_wrap& lookup_tables) {
+    // every square gets the attack set of each of its blocker boards, at the index of the backend in use
 
-        // initialize the lookup table
-        for (int j = 0; j < MAGIC_TABLE_SIZE; j++) {
-            lookup_table[position*MAGIC_TABLE_SIZE + j] = 0;
-        }
-
-        // fill the lookup table
-        for (int j = 0; j < blocker_boards.size(); j++) {
-            U64 index = (blocker_boards[j] * candidate_magic) >> (64 - index_bits);
-            if (lookup_table[position*MAGIC_TABLE_SIZE + index] == 0) {
-                lookup_table[position*MAGIC_TABLE_SIZE + index] = attack_bitboards[j];
-            }
-            else if (lookup_table[position*MAGIC_TABLE_SIZE + index] != attack_bitboards[j]) {
-                valid = false;
-                break;
-            }
+    for (int i = 0; i < 64; i++) {
+        const magic_entry& bishop = lookup_tables.bishop_magics[i];
+        for (U64 blocker_board : get_blocker_boards(i, bishop.mask)) {
+            lookup_tables.slider_attack_table[bishop.offset + slider_index(bishop, blocker_board)] = get_bishop_attack(i, blocker_board);
         }
 
-        // stop looking if a valid magic number is found
-        if (valid) {
-            break;
+        const magic_entry& rook = lookup_tables.rook_magics[i];
+        for (U64 blocker_board : get_blocker_boards(i, rook.mask)) {
+            lookup_tables.slider_attack_table[rook.offset + slider_index(rook, blocker_board)] = get_rook_attack(i, blocker_board);
         }
     }
 }
@@ -151,43 +144,6 @@ void generate_magics(int position, U64 mask_bitboard, std::vector<U64> blocker_b
 // lookup table initialization functions
 
 // pawn
-U64 get_pawn_move(int position, bool color) {
-    // returns a bitboard with one or two squares in front of the pawn set
-
-    // initialize
-    U64 pawn_move_bitboard = 0;
-    int direction;
-
-    if (color) {
-        direction = -1;
-    }
-    else {
-        direction = 1;
-    }
-
-    // check if pawn is on starting rank
-    if (((8 + color*40) <= position) && (position < (16 + color*40))) {
-        std::array<int, 2> moves = {8, 16};
-
-        for (int move : moves) {
-            if (position + move*direction >= 0 && position + move*direction < 64) {
-                pawn_move_bitboard |= 1ULL << (position + move*direction);
-            }
-        }
-    }
-    else {
-        std::array<int, 1> moves = {8};
-
-        for (int move : moves) {
-            if (position + move*direction >= 0 && position + move*direction < 64) {
-                pawn_move_bitboard |= 1ULL << (position + move*direction);
-            }
-        }
-    }
-
-    return pawn_move_bitboard;
-}
-
 U64 get_pawn_attack(int position, bool color) {
     // returns a bitboard with the two squares diagonally in front of the pawn set
 
@@ -517,101 +473,84 @@ U64 get_king_attack(int position) {
 
 // move generation
 
-U64 attacked(game_state state, bool color, 
-    lookup_tables_wrap& lookup_tables,
-    const U64& occupancy_bitboard) {
-    // return a bitboard of all attacked positions by the given color
-    
-    // initialize
-    U64 attacked_bitboard = 0;
-
-    // iterate over all pieces
-    for (int i = 0; i < 6; i++) {
-
-        // get the correct piece bitboard
-        U64 piece_bitboard = state.piece_bitboards[i + 6*color];
-        while (piece_bitboard) {
-
-            // get the position of the least significant set bit and remove it from the bitboard
-            int position = pop_lsb(piece_bitboard);
-        
-            // get the possible moves for the piece
-            U64 possible_moves = 0;
-            switch (i) {
-                // pawn
-                case 0: {
-                    possible_moves = lookup_tables.pawn_attack_lookup_table[position + NUM_SQUARES*color];
-                    break;
-                }
-
-                // knight
-                case 1: {
-                    possible_moves = lookup_tables.knight_lookup_table[position];
-                    break;
-                }
-
-                // bishop
-                case 2: {
-                    U64 bishop_blocker_bitboard = lookup_tables.bishop_mask_lookup_table[position] & occupancy_bitboard;
-                    int index = (bishop_blocker_bitboard * lookup_tables.bishop_magics[position]) >> (64 - lookup_tables.bishop_mask_bit_count[position]);
-                    possible_moves = lookup_tables.bishop_attack_lookup_table[ position*MAGIC_TABLE_SIZE + index];
-                    break;
-                }
+template <bool Color>
+int pseudo_legal_move_generator(move_list& moves, const game_state& state, 
+    lookup_tables_wrap& lookup_tables) {
+    // generate all pseudo legal moves for the given color in the given game state
+    // Color is the color of the attacker
 
-                // rook
-                case 3: {
-                    U64 rook_blocker_bitboard = lookup_tables.rook_mask_lookup_table[position] & occupancy_bitboard;
-                    int index = (rook_blocker_bitboard * lookup_tables.rook_magics[position]) >> (64 - lookup_tables.rook_mask_bit_count[position]);
-                    possible_moves = lookup_tables.rook_attack_lookup_table[ position*MAGIC_TABLE_SIZE + index];
-                    break;
-                }
-                
-                // queen
-                case 4: {
-                    // bishop aspect
-                    U64 bishop_blocker_bitboard = lookup_tables.bishop_mask_lookup_table[position] & occupancy_bitboard;
-                    int index = (bishop_blocker_bitboard * lookup_tables.bishop_magics[position]) >> (64 - lookup_tables.bishop_mask_bit_count[position]);
-                    U64 possible_bishop_moves = lookup_tables.bishop_attack_lookup_table[ position*MAGIC_TABLE_SIZE + index];
+    // initialize
+    moves.size = 0;
+    U64 occupancy_bitboard = state.occupancy;
+    U64 own_pieces = state.color_bitboards[Color];
+    U64 opponent_pieces = state.color_bitboards[!Color];
+
+    int forward = Color ? -8 : 8;
+    int capture_west = Color ? -9 : 7;
+    int capture_east = Color ? -7 : 9;
+
+    // in check, the pieces other than the king can only capture the checker or block the check
+    // in double check, only the king can move
+    U64 checkers = state.info.checkers;
+    U64 evasion_mask = ~0ULL;
+    U64 capture_mask = ~0ULL;
+    if (checkers) {
+        int king_position = __builtin_ctzll(state.type_bitboards[5] & own_pieces);
+        evasion_mask = checkers & (checkers - 1) ? 0 : checkers | lookup_tables.between_table[king_position][__builtin_ctzll(checkers)];
+        capture_mask = evasion_mask;
+        // a pawn that gives check after a double push can also be captured en passant
+        if (state.en_passant_square != NO_SQUARE && evasion_mask && (checkers & (1ULL << (state.en_passant_square - forward)))) {
+            capture_mask |= state.en_passant_bitboard();
+        }
+    }
 
-                    // rook aspect
-                    U64 rook_blocker_bitboard = lookup_tables.rook_mask_lookup_table[position] & occupancy_bitboard;
-                    index = (rook_blocker_bitboard * lookup_tables.rook_magics[position]) >> (64 - lookup_tables.rook_mask_bit_count[position]);
-                    U64 possible_rook_moves = lookup_tables.rook_attack_lookup_table[ position*MAGIC_TABLE_SIZE + index];
-                    
-                    //combine
-                    possible_moves = possible_bishop_moves | possible_rook_moves;
-                    break;
-                }
+    // pawns
+    // all pawns are moved at once by shifting the pawn bitboard, the from square is the to square minus the shift
+    // pawns on the a file can not capture towards the a file and pawns on the h file not towards the h file
+    U64 pawns = state.type_bitboards[0] & own_pieces;
+    U64 empty = ~occupancy_bitboard;
+    U64 capturable = (opponent_pieces | state.en_passant_bitboard()) & capture_mask;
+    U64 promotion_rank = Color ? RANK_1_MASK : RANK_8_MASK;
+
+    U64 single_pushes = (Color ? pawns >> 8 : pawns << 8) & empty;
+    // a double push is a single push from the third rank that can be pushed once more
+    U64 double_pushes = (Color ? (single_pushes & (RANK_1_MASK << 40)) >> 8 : (single_pushes & (RANK_1_MASK << 16)) << 8) & empty & evasion_mask;
+    single_pushes &= evasion_mask;
+    U64 west_captures = (Color ? (pawns & ~FILE_A_MASK) >> 9 : (pawns & ~FILE_A_MASK) << 7) & capturable;
+    U64 east_captures = (Color ? (pawns & ~FILE_H_MASK) >> 7 : (pawns & ~FILE_H_MASK) << 9) & capturable;
+
+    auto add_pawn_moves = [&](U64 targets, int shift) {
+        U64 promotions = targets & promotion_rank;
+        targets &= ~promotion_rank;
+
+        while (targets) {
+            int to = pop_lsb(targets);
+            moves.add(move(to - shift, to));
+        }
 
-                // king
-                case 5: {
-                    possible_moves = lookup_tables.king_lookup_table[position];
-                    break;
-                }
+        while (promotions) {
+            int to = pop_lsb(promotions);
+            for (int j = 1; j < 5; j++) {
+                moves.add(move(to - shift, to, PROMOTION + j - 1));
             }
-
-            // add possible_moves to the attacked_bitboard
-            attacked_bitboard |= possible_moves;
         }
-    }
+    };
 
-    return attacked_bitboard;
-}
+    add_pawn_moves(single_pushes, forward);
+    add_pawn_moves(west_captures, capture_west);
+    add_pawn_moves(east_captures, capture_east);
 
-int pseudo_legal_move_generator(std::array<move, 256>& moves, game_state& state, bool color, 
-    lookup_tables_wrap& lookup_tables,
-    const U64& occupancy_bitboard) {
-    // generate all pseudo legal moves for the given color in the given game state
-    // color is the color of the attacker
-
-    // initialize
-    int move_index = 0;
+    // a double push makes the pawn en passantable
+    while (double_pushes) {
+        int to = pop_lsb(double_pushes);
+        moves.add(move(to - 2*forward, to, DOUBLE_PAWN_PUSH));
+    }
 
-    // iterate over all pieces
-    for (int i = 0; i < 6; i++) {
+    // iterate over all other pieces
+    for (int i = 1; i < 6; i++) {
 
         // get the correct piece bitboard
-        U64 piece_bitboard = state.piece_bitboards[i + 6*color];
+        U64 piece_bitboard = state.type_bitboards[i] & own_pieces;
         while (piece_bitboard) {
 
             // get the position of the least significant set bit and remove it from the bitboard
@@ -619,42 +558,8 @@ int pseudo_legal_move_generator(std::array<move, 256>& moves, game_state& state,
         
             // get the possible moves for the piece
             U64 possible_moves = 0;
-            bool promotion = false;
-            bool en_passantable = false;
 
             switch (i) {
-                // pawn
-                case 0: {
-                    
-                    U64 pawn_move_bitboard = 0;
-
-                    // check if pawn is not blocked
-                    if (!(occupancy_bitboard & (1ULL << position + 8 - 16*color))) {
-                        // get normal pawn moves
-                        pawn_move_bitboard = lookup_tables.pawn_move_lookup_table[position + NUM_SQUARES*color];
-                        // only keep moves that are not blocked
-                        pawn_move_bitboard = pawn_move_bitboard & ~occupancy_bitboard;
-
-                        // set en passant bool
-                        // this operation checks if the pawn move bitboard has more than one set bit
-                        en_passantable = pawn_move_bitboard & (pawn_move_bitboard - 1);
-                    }
-
-                    // get pawn attack moves
-                    U64 pawn_attack_bitboard = lookup_tables.pawn_attack_lookup_table[position + NUM_SQUARES*color];
-                    // only keep moves that capture something
-                    pawn_attack_bitboard = pawn_attack_bitboard & (occupancy_bitboard | state.en_passant_bitboards[!color]);
-                    
-                    // set promotion bool
-                    if (((48 - color*40) <= position) and (position < (56 - color*40))) {
-                        promotion = true;
-                    }
-
-                    // combine the move and attack bitboards
-                    possible_moves = pawn_move_bitboard | pawn_attack_bitboard;
-                    break;
-                }
-
                 // knight
                 case 1: {
                     possible_moves = lookup_tables.knight_lookup_table[position];
@@ -664,31 +569,23 @@ int pseudo_legal_move_generator(std::array<move, 256>& moves, game_state& state,
                 // bishop
                 case 2: {
                     
-                    U64 bishop_blocker_bitboard = lookup_tables.bishop_mask_lookup_table[position] & occupancy_bitboard;
-                    int index = (bishop_blocker_bitboard * lookup_tables.bishop_magics[position]) >> (64 - lookup_tables.bishop_mask_bit_count[position]);
-                    possible_moves = lookup_tables.bishop_attack_lookup_table[position*MAGIC_TABLE_SIZE + index];
+                    possible_moves = bishop_attacks(lookup_tables, position, occupancy_bitboard);
                     break;
                 }
 
                 // rook
                 case 3: {
-                    U64 rook_blocker_bitboard = lookup_tables.rook_mask_lookup_table[position] & occupancy_bitboard;
-                    int index = (rook_blocker_bitboard * lookup_tables.rook_magics[position]) >> (64 - lookup_tables.rook_mask_bit_count[position]);
-                    possible_moves = lookup_tables.rook_attack_lookup_table[position*MAGIC_TABLE_SIZE + index];
+                    possible_moves = rook_attacks(lookup_tables, position, occupancy_bitboard);
                     break;
                 }
                 
                 // queen
                 case 4: {
                     // bishop aspect
-                    U64 bishop_blocker_bitboard = lookup_tables.bishop_mask_lookup_table[position] & occupancy_bitboard;
-                    int index = (bishop_blocker_bitboard * lookup_tables.bishop_magics[position]) >> (64 - lookup_tables.bishop_mask_bit_count[position]);
-                    U64 possible_bishop_moves = lookup_tables.bishop_attack_lookup_table[position*MAGIC_TABLE_SIZE + index];
+                    U64 possible_bishop_moves = bishop_attacks(lookup_tables, position, occupancy_bitboard);
 
                     // rook aspect
-                    U64 rook_blocker_bitboard = lookup_tables.rook_mask_lookup_table[position] & occupancy_bitboard;
-                    index = (rook_blocker_bitboard * lookup_tables.rook_magics[position]) >> (64 - lookup_tables.rook_mask_bit_count[position]);
-                    U64 possible_rook_moves = lookup_tables.rook_attack_lookup_table[position*MAGIC_TABLE_SIZE + index];
+                    U64 possible_rook_moves = rook_attacks(lookup_tables, position, occupancy_bitboard);
                     
                     //combine
                     possible_moves = possible_bishop_moves | possible_rook_moves;
@@ -696,18 +593,24 @@ int pseudo_legal_move_generator(std::array<move, 256>& moves, game_state& state,
                 }
 
                 // king
+                // the king does not move to attacked squares, it is taken out of the occupancy so it does not hide the squares behind it from a slider
                 case 5: {
-                    possible_moves = lookup_tables.king_lookup_table[position];
+                    U64 targets = lookup_tables.king_lookup_table[position] & ~own_pieces;
+                    U64 occupancy_without_king = occupancy_bitboard ^ (1ULL << position);
+                    while (targets) {
+                        int target = pop_lsb(targets);
+                        if (!(attackers_to(state, target, occupancy_without_king, lookup_tables) & opponent_pieces)) {
+                            possible_moves |= 1ULL << target;
+                        }
+                    }
                     break;
                 }
             }
 
-            // filter out capturing of own pieces
-            if (color) {
-                possible_moves = possible_moves & ~combine_black(state.piece_bitboards);
-            }
-            else {
-                possible_moves = possible_moves & ~combine_white(state.piece_bitboards);
+            // filter out capturing of own pieces, and the moves that do not answer a check
+            possible_moves = possible_moves & ~own_pieces;
+            if (i != 5) {
+                possible_moves &= evasion_mask;
             }
 
             // turn the possible_moves bitboard into an array of moves
@@ -715,64 +618,49 @@ int pseudo_legal_move_generator(std::array<move, 256>& moves, game_state& state,
 
                 // get the position of the least significant set bit
                 int move_position = pop_lsb(possible_moves);
-
-                // check if the move creates an en passantable pawn
-                if (en_passantable && (std::abs(position - move_position) > 9)) {
-                    // validly en passantable
-                    moves[move_index] = move(i + 6*color, position, move_position, i + 6*color, true, false);
-                    move_index++;
-                }
-
-                // check if the move is a promotion
-                else if (promotion) {
-                    for (int j = 1; j < 5; j++) {
-                        moves[move_index] = move(i + 6*color, position, move_position, j + 6*color, false, false);
-                        move_index++;
-                    }
-                }
-
-                // normal moves
-                else {
-                    moves[move_index] = move(i + 6*color, position, move_position, i + 6*color, false, false);
-                    move_index++;
-                }
+                moves.add(move(position, move_position));
             }
         }
     }
 
     // castling
 
-    bool long_castle;
-    bool short_castle;
+    bool long_castle = state.castling_rights & (Color ? BLACK_LONG_CASTLE : WHITE_LONG_CASTLE);
+    bool short_castle = state.castling_rights & (Color ? BLACK_SHORT_CASTLE : WHITE_SHORT_CASTLE);
     U64 long_castle_occupation_mask = 0;
     U64 short_castle_occupation_mask = 0;
     U64 long_castle_check_mask = 0;
     U64 short_castle_check_mask = 0;
     
-    if (color) {
-        long_castle = state.b_long_castle;
-        short_castle = state.b_short_castle;
+    if (Color) {
         long_castle_occupation_mask = 1008806316530991104;
         short_castle_occupation_mask = 6917529027641081856;
         long_castle_check_mask = 2017612633061982208;
         short_castle_check_mask = 8070450532247928832;
     }
     else {
-        long_castle = state.w_long_castle;
-        short_castle = state.w_short_castle;
         long_castle_occupation_mask = 14;
         short_castle_occupation_mask = 96;
         long_castle_check_mask = 28;
         short_castle_check_mask = 112;
     }
 
+    // the squares the king passes are tested one by one, the king is not in check if none of them is attacked
+    auto any_attacked = [&](U64 squares) {
+        while (squares) {
+            if (is_square_attacked<!Color>(state, pop_lsb(squares), lookup_tables)) {
+                return true;
+            }
+        }
+        return false;
+    };
+
     // long castle
+    // castling out of check is not allowed, the king square is tested with the squares it passes
     if (long_castle) {
         if (!(occupancy_bitboard & long_castle_occupation_mask)) {
-            U64 attacked_bitboard = attacked(state, !color, lookup_tables, occupancy_bitboard);
-            if (!(attacked_bitboard & long_castle_check_mask)) {
-                moves[move_index] = move(5 + 6*color, 4 + 56*color, 2 + 56*color, 5 + 6*color, false, true);
-                move_index++;
+            if (!any_attacked(long_castle_check_mask)) {
+                moves.add(move(4 + 56*Color, 2 + 56*Color, CASTLING));
             }
         }
     }
@@ -780,20 +668,17 @@ int pseudo_legal_move_generator(std::array<move, 256>& moves, game_state& state,
     // short castle
     if (short_castle) {
         if (!(occupancy_bitboard & short_castle_occupation_mask)) {
-            U64 attacked_bitboard = attacked(state, !color, lookup_tables, occupancy_bitboard);
-            if (!(attacked_bitboard & short_castle_check_mask)) {
-                moves[move_index] = move(5 + 6*color, 4 + 56*color, 6 + 56*color, 5 + 6*color, false, true);
-                move_index++;
+            if (!any_attacked(short_castle_check_mask)) {
+                moves.add(move(4 + 56*Color, 6 + 56*Color, CASTLING));
             }
         }
     }
 
-    return move_index;
+    return moves.size;
 }
 
-U64 init_zobrist_hashing_mailbox(game_state &state, zobrist_randoms &zobrist, bool color, std::array<int, 64>& piece_on_square) {
+U64 init_zobrist_hashing(const game_state &state, zobrist_randoms &zobrist, bool color) {
     // create random bitstrings for each game element and hash the first position
-    // populate the mailbox representation with the piece index
 
     // generate a seed
     std::random_device rd;
@@ -811,67 +696,51 @@ U64 init_zobrist_hashing_mailbox(game_state &state, zobrist_randoms &zobrist, bo
     }
 
     zobrist.zobrist_black_to_move = dist(rng);
-    zobrist.zobrist_w_long_castle = dist(rng);
-    zobrist.zobrist_w_short_castle = dist(rng);
-    zobrist.zobrist_b_long_castle = dist(rng);
-    zobrist.zobrist_b_short_castle = dist(rng);
+
+    // one random per castling right, the key of a rights value combines the randoms of its rights
+    std::array<U64, 4> castling_randoms;
+    for (int i = 0; i < 4; ++i) {
+        castling_randoms[i] = dist(rng);
+    }
+    for (int rights = 0; rights < 16; ++rights) {
+        zobrist.zobrist_castling[rights] = 0;
+        for (int i = 0; i < 4; ++i) {
+            if (rights & (1 << i)) {
+                zobrist.zobrist_castling[rights] ^= castling_randoms[i];
+            }
+        }
+    }
 
     for (int i = 0; i < 8; ++i) {
         zobrist.zobrist_en_passant[i] = dist(rng);
     }
 
-    // initialize the hash
+    return compute_zobrist_hash(state, zobrist, color);
+}
+
+U64 compute_zobrist_hash(const game_state &state, const zobrist_randoms &zobrist, bool color) {
+    // hash a position from scratch with the existing randoms
     U64 hash = 0;
     // hash the pieces
     for (int i = 0; i < NUM_PIECES; ++i) {
-        U64 bb = state.piece_bitboards[i];
+        U64 bb = state.piece_bitboard(i);
         while (bb) {
             int position = __builtin_ctzll(bb);
             hash ^= zobrist.zobrist_piece_table[position*NUM_PIECES + i];
             bb &= bb - 1;
         }
     }
-    // hash the en passant squares
-    for (int i = 0; i < 2; ++i) {
-        U64 bb = state.en_passant_bitboards[i];
-        while (bb) {
-            int file = __builtin_ctzll(bb) % 8;
-            hash ^= zobrist.zobrist_en_passant[file];
-            bb &= bb - 1;
-        }
+    // hash the en passant square
+    if (state.en_passant_square != NO_SQUARE) {
+        hash ^= zobrist.zobrist_en_passant[state.en_passant_square % 8];
     }
     // hash the castling rights
-    if (state.w_long_castle) {
-        hash ^= zobrist.zobrist_w_long_castle;
-    }
-    if (state.w_short_castle) {
-        hash ^= zobrist.zobrist_w_short_castle;
-    }
-    if (state.b_long_castle) {
-        hash ^= zobrist.zobrist_b_long_castle;
-    }
-    if (state.b_short_castle) {
-        hash ^= zobrist.zobrist_b_short_castle;
-    }
+    hash ^= zobrist.zobrist_castling[state.castling_rights];
     // hash the black to move
     if (color == 1) {
         hash ^= zobrist.zobrist_black_to_move;
     }
 
-    // populate the mailbox representation
-    for (int i = 0; i < 12; i++) {
-
-        // get the correct piece bitboard
-        U64 piece_bitboard = state.piece_bitboards[i];
-        while (piece_bitboard) {
-
-            // get the position of the least significant set bit and remove it from the bitboard
-            int position = pop_lsb(piece_bitboard);
-            piece_on_square[position] = i;
-        }
-    }
-        
-
     return hash;
 }
 
@@ -883,354 +752,356 @@ int alternative_piece(int piece_index) {
     return piece_index < 6 ? piece_index + 6 : piece_index - 6;
 }
 
-void apply_move(game_state& state, move& move_to_apply, U64& zobrist_hash, zobrist_randoms &zobrist, move_undo& undo, std::array<int, 64>& piece_on_square, const linear_layer<INPUT_SIZE, HIDDEN1_SIZE>& layer1, NNUE_accumulator& accumulator) {
+template <bool Color, typename Eval>
+void apply_move(game_state& state, move& move_to_apply, U64& zobrist_hash, zobrist_randoms &zobrist, move_undo& undo, Eval& eval, const prefetch_hint& hint) {
     // apply a move object to a gamestate bitboard
+    // Color is the color of the moving piece
 
-    // initialize
-    std::vector<int> added_features_w;
-    std::vector<int> removed_features_w;
-    std::vector<int> added_features_b;
-    std::vector<int> removed_features_b;
+    // piece indices and squares of the moving side
+    constexpr int own = 6*Color;
+    constexpr int opponent = 6*!Color;
+    constexpr int forward = Color ? -8 : 8;
+    constexpr int back_rank = 56*Color;
+
+    // the moving piece is read from the mailbox before anything is changed
+    int from_position = move_to_apply.from_position();
+    int to_position = move_to_apply.to_position();
+    int piece_index = state.piece_on_square[from_position];
+    int promotion_piece_index = move_to_apply.promotion() ? own + move_to_apply.promotion_type() : piece_index;
 
     // save undo information
     undo.zobrist_hash = zobrist_hash;
-    undo.w_long_castle = state.w_long_castle;
-    undo.w_short_castle = state.w_short_castle;
-    undo.b_long_castle = state.b_long_castle;
-    undo.b_short_castle = state.b_short_castle;
-    undo.en_passant = false;
-    undo.en_passant_bitboards[0] = state.en_passant_bitboards[0];
-    undo.en_passant_bitboards[1] = state.en_passant_bitboards[1];
-    undo.captured_piece_index = -1;
-
-    // remove the piece from the from position
-    state.piece_bitboards[move_to_apply.piece_index] &= ~(1ULL << move_to_apply.from_position);
-    zobrist_hash ^= zobrist.zobrist_piece_table[move_to_apply.from_position*NUM_PIECES + move_to_apply.piece_index];
-    piece_on_square[move_to_apply.from_position] = 0;
-    removed_features_w.push_back(move_to_apply.from_position + move_to_apply.piece_index*64);
-    removed_features_b.push_back(alternative_position(move_to_apply.from_position) + alternative_piece(move_to_apply.piece_index)*64);
-
-    // add the piece to the to position
-    state.piece_bitboards[move_to_apply.promotion_piece_index] |= 1ULL << move_to_apply.to_position;
-    zobrist_hash ^= zobrist.zobrist_piece_table[move_to_apply.to_position*NUM_PIECES + move_to_apply.piece_index];
-    piece_on_square[move_to_apply.to_position] = move_to_apply.promotion_piece_index;
-    added_features_w.push_back(move_to_apply.to_position + move_to_apply.promotion_piece_index*64);
-    added_features_b.push_back(alternative_position(move_to_apply.to_position) + alternative_piece(move_to_apply.promotion_piece_index)*64);
-
-    // remove potential captured piece
-    // get opponent color
-    bool opponent_color = move_to_apply.piece_index < 6;
+    undo.castling_rights = state.castling_rights;
+    undo.en_passant_square = state.en_passant_square;
+    undo.captured_piece_index = NO_PIECE;
+    undo.info = state.info;
+
+    // new evaluation ply, the changed pieces are reported to the evaluation policy
+    eval.push();
+
+    // remove captured opponent piece, the mailbox tells which one it is
+    int captured_piece_index = state.piece_on_square[to_position];
+    if (captured_piece_index != NO_PIECE) {
+        state.remove_piece(captured_piece_index, to_position);
+        zobrist_hash ^= zobrist.zobrist_piece_table[to_position*NUM_PIECES + captured_piece_index];
+        undo.captured_piece_index = captured_piece_index;
+        eval.add_dirty_piece(captured_piece_index, to_position, -1);
+    }
+
+    // move the piece from the from position to the to position, a promoting pawn arrives as the promotion piece
+    zobrist_hash ^= zobrist.zobrist_piece_table[from_position*NUM_PIECES + piece_index];
+    zobrist_hash ^= zobrist.zobrist_piece_table[to_position*NUM_PIECES + promotion_piece_index];
+    if (promotion_piece_index == piece_index) {
+        state.move_piece(piece_index, from_position, to_position);
+        eval.add_dirty_piece(piece_index, from_position, to_position);
+    }
+    else {
+        state.remove_piece(piece_index, from_position);
+        state.add_piece(promotion_piece_index, to_position);
+        eval.add_dirty_piece(piece_index, from_position, -1);
+        eval.add_dirty_piece(promotion_piece_index, -1, to_position);
+    }
+
     zobrist_hash ^= zobrist.zobrist_black_to_move;
 
-    // remove captured opponent piece
-    for (int i = 0; i < 6; i++) {
-        // check if a capture happens
-        if (state.piece_bitboards[i + 6*opponent_color] & (1ULL << move_to_apply.to_position)) {
-            // remove captured piece
-            state.piece_bitboards[i + 6*opponent_color] &= ~(1ULL << move_to_apply.to_position);
-            zobrist_hash ^= zobrist.zobrist_piece_table[move_to_apply.to_position*NUM_PIECES + (i + 6*opponent_color)];
-            undo.captured_piece_index = i + 6*opponent_color;
-            removed_features_w.push_back(move_to_apply.to_position + (i + 6*opponent_color)*64);
-            removed_features_b.push_back(alternative_position(move_to_apply.to_position) + alternative_piece(i + 6*opponent_color)*64);
-        }
+    // remove captured en passant piece, it is one square behind the to position
+    if (piece_index == own && to_position == state.en_passant_square) {
+        int captured_position = to_position - forward;
+        state.remove_piece(opponent, captured_position);
+        zobrist_hash ^= zobrist.zobrist_piece_table[captured_position*NUM_PIECES + opponent];
+        undo.captured_piece_index = opponent;
+        eval.add_dirty_piece(opponent, captured_position, -1);
     }
 
-    // remove captured en passant piece
-    if (move_to_apply.piece_index == 0) {
-        if (state.en_passant_bitboards[1] & (1ULL << move_to_apply.to_position)) {
-            state.piece_bitboards[6] &= ~(1ULL << (move_to_apply.to_position - 8));
-            zobrist_hash ^= zobrist.zobrist_piece_table[(move_to_apply.to_position - 8)*NUM_PIECES + 6];
-            undo.captured_piece_index = 6;
-            undo.en_passant = true;
-            piece_on_square[move_to_apply.to_position - 8] = 0;
-            removed_features_w.push_back((move_to_apply.to_position - 8) + 6*64);
-            removed_features_b.push_back(alternative_position(move_to_apply.to_position - 8) + 0*64);
-        }
-    }
-    else if (move_to_apply.piece_index == 6) {
-        if (state.en_passant_bitboards[0] & (1ULL << move_to_apply.to_position)) {
-            state.piece_bitboards[0] &= ~(1ULL << (move_to_apply.to_position + 8));
-            zobrist_hash ^= zobrist.zobrist_piece_table[(move_to_apply.to_position + 8)*NUM_PIECES + 0];
-            undo.captured_piece_index = 0;
-            undo.en_passant = true;
-            piece_on_square[move_to_apply.to_position + 8] = 0;
-            removed_features_w.push_back((move_to_apply.to_position + 8) + 0);
-            removed_features_b.push_back(alternative_position(move_to_apply.to_position + 8) + 6*64);
-        }
+    // clear the en passant square
+    if (state.en_passant_square != NO_SQUARE) {
+        zobrist_hash ^= zobrist.zobrist_en_passant[state.en_passant_square % 8];
+        state.en_passant_square = NO_SQUARE;
     }
 
-    // clear en passant bitboards
-    state.en_passant_bitboards[0] = 0;
-    state.en_passant_bitboards[1] = 0;
-
-    // update en passant bitboards
-    if (move_to_apply.en_passantable) {
-        if (move_to_apply.piece_index == 0) {
-            state.en_passant_bitboards[0] = 1ULL << (move_to_apply.to_position - 8);
-        }
-        else if (move_to_apply.piece_index == 6) {
-            state.en_passant_bitboards[1] = 1ULL << (move_to_apply.to_position + 8);
-        }
+    // set the en passant square if an opponent pawn can capture the pushed pawn
+    if (move_to_apply.en_passantable() && state.en_passant_attackers(to_position, !Color)) {
+        state.en_passant_square = to_position - forward;
+        zobrist_hash ^= zobrist.zobrist_en_passant[to_position % 8];
     }
 
     // castling rights
-    if ((state.w_long_castle) && (move_to_apply.to_position == 0)) {
-        zobrist_hash ^= zobrist.zobrist_w_long_castle;
-        state.w_long_castle = false;
-    }
-    else if ((state.w_short_castle) && (move_to_apply.to_position == 7)) {
-        zobrist_hash ^= zobrist.zobrist_w_short_castle;
-        state.w_short_castle = false;
-    }
-    else if ((state.b_long_castle) && (move_to_apply.to_position == 56)) {
-        zobrist_hash ^= zobrist.zobrist_b_long_castle;
-        state.b_long_castle = false;
-    }
-    else if ((state.b_short_castle) && (move_to_apply.to_position == 63)) {
-        zobrist_hash ^= zobrist.zobrist_b_short_castle;
-        state.b_short_castle = false;
-    }
-    // white king
-    if (move_to_apply.piece_index == 5) {
-        if (state.w_long_castle) {
-            zobrist_hash ^= zobrist.zobrist_w_long_castle;
-            state.w_long_castle = false;
-        }
-        if (state.w_short_castle) {
-            zobrist_hash ^= zobrist.zobrist_w_short_castle;
-            state.w_short_castle = false;
-        }        
-    }
-    // black king
-    else if (move_to_apply.piece_index == 11) {
-        if (state.b_long_castle) {
-            zobrist_hash ^= zobrist.zobrist_b_long_castle;
-            state.b_long_castle = false;
-        }
-        if (state.b_short_castle) {
-            zobrist_hash ^= zobrist.zobrist_b_short_castle;
-            state.b_short_castle = false;
-        }
-    }
-    // white rook
-    else if ((state.w_long_castle) && (move_to_apply.piece_index == 3) && (move_to_apply.from_position == 0)) {
-        zobrist_hash ^= zobrist.zobrist_w_long_castle;
-        state.w_long_castle = false;
-    }
-    else if ((state.w_short_castle) && (move_to_apply.piece_index == 3) && (move_to_apply.from_position == 7)) {
-        zobrist_hash ^= zobrist.zobrist_w_short_castle;
-        state.w_short_castle = false;
-    }
-    // black rook
-    else if ((state.b_long_castle) && (move_to_apply.piece_index == 9) && (move_to_apply.from_position == 56)) {
-        zobrist_hash ^= zobrist.zobrist_b_long_castle;
-        state.b_long_castle = false;
-    }
-    else if ((state.b_short_castle) && (move_to_apply.piece_index == 9) && (move_to_apply.from_position == 63)) {
-        zobrist_hash ^= zobrist.zobrist_b_short_castle;
-        state.b_short_castle = false;
-    }
+    // the rights of the squares the piece leaves and enters are removed, the hash key of the rights value is swapped
+    int castling_rights = state.castling_rights & castle_mask[from_position] & castle_mask[to_position];
+    zobrist_hash ^= zobrist.zobrist_castling[state.castling_rights] ^ zobrist.zobrist_castling[castling_rights];
+    state.castling_rights = castling_rights;
 
     // castling
-    if (move_to_apply.castling) {
-        // white long castling
-        if (move_to_apply.to_position == 2) {
-            state.piece_bitboards[3] &= ~(1ULL << 0);
-            state.piece_bitboards[3] |= 1ULL << 3;
-            // update rook part of the hash
-            zobrist_hash ^= zobrist.zobrist_piece_table[0*NUM_PIECES + 3];
-            zobrist_hash ^= zobrist.zobrist_piece_table[3*NUM_PIECES + 3];
-            piece_on_square[3] = 3;
-            piece_on_square[0] = 0;
-            added_features_w.push_back(3 + 3*64);
-            removed_features_w.push_back(0 + 3*64);
-            added_features_b.push_back(59 + 9*64);
-            removed_features_b.push_back(56 + 9*64);
-        }
-        // black long castling
-        else if (move_to_apply.to_position == 58) {
-            state.piece_bitboards[9] &= ~(1ULL << 56);
-            state.piece_bitboards[9] |= 1ULL << 59;
-            // update rook part of the hash
-            zobrist_hash ^= zobrist.zobrist_piece_table[56*NUM_PIECES + 9];
-            zobrist_hash ^= zobrist.zobrist_piece_table[59*NUM_PIECES + 9];
-            piece_on_square[59] = 9;
-            piece_on_square[56] = 0;
-            added_features_w.push_back(59 + 9*64);
-            removed_features_w.push_back(56 + 9*64);
-            added_features_b.push_back(3 + 3*64);
-            removed_features_b.push_back(0 + 3*64);
-        }
-        // white short castling
-        else if (move_to_apply.to_position == 6) {
-            state.piece_bitboards[3] &= ~(1ULL << 7);
-            state.piece_bitboards[3] |= 1ULL << 5;
-            // update rook part of the hash
-            zobrist_hash ^= zobrist.zobrist_piece_table[7*NUM_PIECES + 3];
-            zobrist_hash ^= zobrist.zobrist_piece_table[5*NUM_PIECES + 3];
-            piece_on_square[5] = 3;
-            piece_on_square[7] = 0;
-            added_features_w.push_back(5 + 3*64);
-            removed_features_w.push_back(7 + 3*64);
-            added_features_b.push_back(61 + 9*64);
-            removed_features_b.push_back(63 + 9*64);
-        }
-        // black short castling
-        else if (move_to_apply.to_position == 62) {
-            state.piece_bitboards[9] &= ~(1ULL << 63);
-            state.piece_bitboards[9] |= 1ULL << 61;
-            // update rook part of the hash
-            zobrist_hash ^= zobrist.zobrist_piece_table[63*NUM_PIECES + 9];
-            zobrist_hash ^= zobrist.zobrist_piece_table[61*NUM_PIECES + 9];
-            piece_on_square[61] = 9;
-            piece_on_square[63] = 0;
-            added_features_w.push_back(61 + 9*64);
-            removed_features_w.push_back(63 + 9*64);
-            added_features_b.push_back(5 + 3*64);
-            removed_features_b.push_back(7 + 3*64);
+    if (move_to_apply.castling()) {
+        // the rook jumps over the king, from the corner to the square next to the king
+        int rook_from = back_rank + 7;
+        int rook_to = back_rank + 5;
+        // long castling
+        if (to_position == back_rank + 2) {
+            rook_from = back_rank;
+            rook_to = back_rank + 3;
         }
+        state.move_piece(own + 3, rook_from, rook_to);
+        // update rook part of the hash
+        zobrist_hash ^= zobrist.zobrist_piece_table[rook_from*NUM_PIECES + own + 3];
+        zobrist_hash ^= zobrist.zobrist_piece_table[rook_to*NUM_PIECES + own + 3];
+        eval.add_dirty_piece(own + 3, rook_from, rook_to);
     }
 
-    // update accumulator
-    update_accumulator(layer1, accumulator, removed_features_w, added_features_w, false);
-    update_accumulator(layer1, accumulator, removed_features_b, added_features_b, true);
+    // the hash is final, request the memory the child reads first
+    hint.prefetch(zobrist_hash);
+    if (hint.evaluate) {
+        eval.prefetch(state, zobrist_hash);
+    }
 }
 
-void undo_move(game_state& state, move& move_to_undo, U64& zobrist_hash, zobrist_randoms &zobrist, move_undo& undo, std::array<int, 64>& piece_on_square, const linear_layer<INPUT_SIZE, HIDDEN1_SIZE>& layer1, NNUE_accumulator& accumulator) {
+template <bool Color, typename Eval>
+void undo_move(game_state& state, move& move_to_undo, U64& zobrist_hash, move_undo& undo, Eval& eval) {
     // undo a move object to a gamestate bitboard
+    // Color is the color of the moving piece
 
-    // initialize
-    std::vector<int> added_features_w;
-    std::vector<int> removed_features_w;
-    std::vector<int> added_features_b;
-    std::vector<int> removed_features_b;
+    constexpr int own = 6*Color;
+    constexpr int forward = Color ? -8 : 8;
+    constexpr int back_rank = 56*Color;
+
+    // the moved piece is on the to position, a promoted piece was a pawn
+    int from_position = move_to_undo.from_position();
+    int to_position = move_to_undo.to_position();
+    int promotion_piece_index = state.piece_on_square[to_position];
+    int piece_index = move_to_undo.promotion() ? own : promotion_piece_index;
+
+    // the evaluation state of the parent is still on the stack
+    eval.pop();
 
     // apply undo information
     zobrist_hash = undo.zobrist_hash;
-    state.w_long_castle = undo.w_long_castle;
-    state.w_short_castle = undo.w_short_castle;
-    state.b_long_castle = undo.b_long_castle;
-    state.b_short_castle = undo.b_short_castle;
-    state.en_passant_bitboards[0] = undo.en_passant_bitboards[0];
-    state.en_passant_bitboards[1] = undo.en_passant_bitboards[1];
-
-    // remove the piece from the to position
-    state.piece_bitboards[move_to_undo.promotion_piece_index] &= ~(1ULL << move_to_undo.to_position);
-    piece_on_square[move_to_undo.to_position] = 0;
-    removed_features_w.push_back(move_to_undo.to_position + move_to_undo.promotion_piece_index*64);
-    removed_features_b.push_back(alternative_position(move_to_undo.to_position) + alternative_piece(move_to_undo.promotion_piece_index)*64);
-
-    // add the piece to the from position
-    state.piece_bitboards[move_to_undo.piece_index] |= 1ULL << move_to_undo.from_position;
-    piece_on_square[move_to_undo.from_position] = move_to_undo.piece_index;
-    added_features_w.push_back(move_to_undo.from_position + move_to_undo.piece_index*64);
-    added_features_b.push_back(alternative_position(move_to_undo.from_position) + alternative_piece(move_to_undo.piece_index)*64);
+    state.castling_rights = undo.castling_rights;
+    state.en_passant_square = undo.en_passant_square;
+    state.info = undo.info;
+
+    // move the piece back from the to position to the from position
+    if (promotion_piece_index == piece_index) {
+        state.move_piece(piece_index, to_position, from_position);
+    }
+    else {
+        state.remove_piece(promotion_piece_index, to_position);
+        state.add_piece(piece_index, from_position);
+    }
 
     // captured pieces
-    if (undo.captured_piece_index != -1) {
-        // check for en passant
-        if (undo.en_passant) {
-            if (undo.captured_piece_index == 0) {
-                state.piece_bitboards[undo.captured_piece_index] |= 1ULL << (move_to_undo.to_position + 8);
-                piece_on_square[move_to_undo.to_position + 8] = undo.captured_piece_index;
-                added_features_w.push_back((move_to_undo.to_position + 8) + undo.captured_piece_index*64);
-                added_features_b.push_back(alternative_position(move_to_undo.to_position + 8) + alternative_piece(undo.captured_piece_index)*64);
-            }
-            else if (undo.captured_piece_index == 6) {
-                state.piece_bitboards[undo.captured_piece_index] |= 1ULL << (move_to_undo.to_position - 8);
-                piece_on_square[move_to_undo.to_position - 8] = undo.captured_piece_index;
-                added_features_w.push_back((move_to_undo.to_position - 8) + undo.captured_piece_index*64);
-                added_features_b.push_back(alternative_position(move_to_undo.to_position - 8) + alternative_piece(undo.captured_piece_index)*64);
-            }
-        }
-        else {
-            state.piece_bitboards[undo.captured_piece_index] |= 1ULL << move_to_undo.to_position;
-            piece_on_square[move_to_undo.to_position] = undo.captured_piece_index;
-            added_features_w.push_back(move_to_undo.to_position + undo.captured_piece_index*64);
-            added_features_b.push_back(alternative_position(move_to_undo.to_position) + alternative_piece(undo.captured_piece_index)*64);
-        }
+    if (undo.captured_piece_index != NO_PIECE) {
+        // an en passant capture is a pawn moving to the en passant square, the captured pawn is one square behind it
+        bool en_passant = piece_index == own && to_position == undo.en_passant_square;
+        int captured_position = en_passant ? to_position - forward : to_position;
+        state.add_piece(undo.captured_piece_index, captured_position);
     }
 
     // undo rook moves in castling
-    if (move_to_undo.castling) {
-        // white long castling
-        if (move_to_undo.to_position == 2) {
-            state.piece_bitboards[3] &= ~(1ULL << 3);
-            state.piece_bitboards[3] |= 1ULL << 0;
-            piece_on_square[0] = 3;
-            piece_on_square[3] = 0;
-            added_features_w.push_back(0 + 3*64);
-            removed_features_w.push_back(3 + 3*64);
-            added_features_b.push_back(56 + 9*64);
-            removed_features_b.push_back(59 + 9*64);
+    if (move_to_undo.castling()) {
+        int rook_from = back_rank + 7;
+        int rook_to = back_rank + 5;
+        // long castling
+        if (to_position == back_rank + 2) {
+            rook_from = back_rank;
+            rook_to = back_rank + 3;
         }
-        // black long castling
-        else if (move_to_undo.to_position == 58) {
-            state.piece_bitboards[9] &= ~(1ULL << 59);
-            state.piece_bitboards[9] |= 1ULL << 56;
-            piece_on_square[56] = 9;
-            piece_on_square[59] = 0;
-            added_features_w.push_back(56 + 9*64);
-            removed_features_w.push_back(59 + 9*64);
-            added_features_b.push_back(0 + 3*64);
-            removed_features_b.push_back(3 + 3*64);
+        state.move_piece(own + 3, rook_to, rook_from);
+    }
+}
+
+// make/unmake for both colors and every evaluation policy
+template void apply_move<false, handcrafted_eval>(game_state&, move&, U64&, zobrist_randoms&, move_undo&, handcrafted_eval&, const prefetch_hint&);
+template void apply_move<true, handcrafted_eval>(game_state&, move&, U64&, zobrist_randoms&, move_undo&, handcrafted_eval&, const prefetch_hint&);
+template void apply_move<false, nnue_eval>(game_state&, move&, U64&, zobrist_randoms&, move_undo&, nnue_eval&, const prefetch_hint&);
+template void apply_move<true, nnue_eval>(game_state&, move&, U64&, zobrist_randoms&, move_undo&, nnue_eval&, const prefetch_hint&);
+template void apply_move<false, no_eval>(game_state&, move&, U64&, zobrist_randoms&, move_undo&, no_eval&, const prefetch_hint&);
+template void apply_move<true, no_eval>(game_state&, move&, U64&, zobrist_randoms&, move_undo&, no_eval&, const prefetch_hint&);
+template void undo_move<false, handcrafted_eval>(game_state&, move&, U64&, move_undo&, handcrafted_eval&);
+template void undo_move<true, handcrafted_eval>(game_state&, move&, U64&, move_undo&, handcrafted_eval&);
+template void undo_move<false, nnue_eval>(game_state&, move&, U64&, move_undo&, nnue_eval&);
+template void undo_move<true, nnue_eval>(game_state&, move&, U64&, move_undo&, nnue_eval&);
+template void undo_move<false, no_eval>(game_state&, move&, U64&, move_undo&, no_eval&);
+template void undo_move<true, no_eval>(game_state&, move&, U64&, move_undo&, no_eval&);
+
+template <bool Color>
+bool pseudo_to_legal(const game_state& state, 
+    lookup_tables_wrap& lookup_tables) {
+    // check if a given game state is legal for the given color
+    // Color is the color to move, the state is illegal if it attacks the king of the other color
+
+    // get the king position
+    int king_position = __builtin_ctzll(state.type_bitboards[5] & state.color_bitboards[!Color]);
+
+    // check if the king is attacked
+    return !is_square_attacked<Color>(state, king_position, lookup_tables);
+}
+
+// the pieces of both colors that are the only piece between a king and a slider of the attackers
+// the sliders are looked up from the king square on an empty board, every slider with one piece between it and the king pins or discovers
+U64 slider_blockers(const game_state& state, int king_position, U64 attackers, 
+    const lookup_tables_wrap& lookup_tables) {
+    U64 bishops_queens = (state.type_bitboards[2] | state.type_bitboards[4]) & attackers;
+    U64 rooks_queens = (state.type_bitboards[3] | state.type_bitboards[4]) & attackers;
+    U64 snipers = (bishop_attacks(lookup_tables, king_position, 0) & bishops_queens) |
+        (rook_attacks(lookup_tables, king_position, 0) & rooks_queens);
+    U64 occupancy_bitboard = state.occupancy ^ snipers;
+
+    U64 blockers = 0;
+    while (snipers) {
+        int sniper_position = pop_lsb(snipers);
+        U64 between = lookup_tables.between_table[king_position][sniper_position] & occupancy_bitboard;
+        if (between && !(between & (between - 1))) {
+            blockers |= between;
         }
-        // white short castling
-        else if (move_to_undo.to_position == 6) {
-            state.piece_bitboards[3] &= ~(1ULL << 5);
-            state.piece_bitboards[3] |= 1ULL << 7;
-            piece_on_square[7] = 3;
-            piece_on_square[5] = 0;
-            added_features_w.push_back(7 + 3*64);
-            removed_features_w.push_back(5 + 3*64);
-            added_features_b.push_back(63 + 9*64);
-            removed_features_b.push_back(61 + 9*64);
+    }
+    return blockers;
+}
+
+template <bool Color>
+void update_state_info(game_state& state, 
+    const lookup_tables_wrap& lookup_tables) {
+    // Color is the side to move
+
+    state_info& info = state.info;
+    U64 own_pieces = state.color_bitboards[Color];
+    U64 opponent_pieces = state.color_bitboards[!Color];
+    int king_position = __builtin_ctzll(state.type_bitboards[5] & own_pieces);
+    int opponent_king_position = __builtin_ctzll(state.type_bitboards[5] & opponent_pieces);
+
+    info.checkers = attackers_to(state, king_position, state.occupancy, lookup_tables) & opponent_pieces;
+    info.blockers[Color] = slider_blockers(state, king_position, opponent_pieces, lookup_tables);
+    info.blockers[!Color] = slider_blockers(state, opponent_king_position, own_pieces, lookup_tables);
+    info.pinned[Color] = info.blockers[Color] & own_pieces;
+    info.pinned[!Color] = info.blockers[!Color] & opponent_pieces;
+
+    // a piece gives check from the squares that the same piece on the opponent king square attacks
+    // the pawns attack in one direction, so the pawn attacks of the opponent color are used
+    info.check_squares[0] = lookup_tables.pawn_attack_lookup_table[opponent_king_position + NUM_SQUARES*!Color];
+    info.check_squares[1] = lookup_tables.knight_lookup_table[opponent_king_position];
+    info.check_squares[2] = bishop_attacks(lookup_tables, opponent_king_position, state.occupancy);
+    info.check_squares[3] = rook_attacks(lookup_tables, opponent_king_position, state.occupancy);
+    info.check_squares[4] = info.check_squares[2] | info.check_squares[3];
+    info.check_squares[5] = 0;
+}
+
+template <bool Color>
+bool legal(const game_state& state, const move& move_to_check, 
+    const lookup_tables_wrap& lookup_tables) {
+    // Color is the side to move, the move comes from the move generation of this position
+
+    constexpr int own = 6*Color;
+    constexpr int forward = Color ? -8 : 8;
+
+    int from_position = move_to_check.from_position();
+    int to_position = move_to_check.to_position();
+    int piece_index = state.piece_on_square[from_position];
+    int king_position = __builtin_ctzll(state.type_bitboards[5] & state.color_bitboards[Color]);
+
+    // king moves to attacked squares and castling through attacked squares are not generated
+    if (piece_index == own + 5) {
+        return true;
+    }
+
+    // an en passant capture removes two pieces from the rank of the king, the king square is tested directly
+    if (piece_index == own && to_position == state.en_passant_square) {
+        int captured_position = to_position - forward;
+        U64 occupancy_bitboard = state.occupancy ^ (1ULL << from_position) ^ (1ULL << captured_position) ^ (1ULL << to_position);
+        U64 attackers = attackers_to(state, king_position, occupancy_bitboard, lookup_tables) & state.color_bitboards[!Color];
+        return !(attackers & ~(1ULL << captured_position));
+    }
+
+    // in check, the move has to capture the checker or block the check, double checks are left to the king
+    U64 checkers = state.info.checkers;
+    if (checkers) {
+        if (checkers & (checkers - 1)) {
+            return false;
         }
-        // black short castling
-        else if (move_to_undo.to_position == 62) {
-            state.piece_bitboards[9] &= ~(1ULL << 61);
-            state.piece_bitboards[9] |= 1ULL << 63;
-            piece_on_square[63] = 9;
-            piece_on_square[61] = 0;
-            added_features_w.push_back(63 + 9*64);
-            removed_features_w.push_back(61 + 9*64);
-            added_features_b.push_back(5 + 3*64);
-            removed_features_b.push_back(7 + 3*64);
+        U64 evasions = checkers | lookup_tables.between_table[king_position][__builtin_ctzll(checkers)];
+        if (!(evasions & (1ULL << to_position))) {
+            return false;
         }
     }
 
-    // update accumulator
-    update_accumulator(layer1, accumulator, removed_features_w, added_features_w, false);
-    update_accumulator(layer1, accumulator, removed_features_b, added_features_b, true);
+    // a pinned piece can only move along the line through its king
+    return !(state.info.pinned[Color] & (1ULL << from_position)) ||
+        (lookup_tables.line_table[king_position][from_position] & (1ULL << to_position));
 }
 
-bool pseudo_to_legal(game_state& state, bool color, 
-    lookup_tables_wrap& lookup_tables,
-    const U64& occupancy_bitboard) {
-    // check if a given game state is legal for the given color
+template <bool Color>
+bool gives_check(const game_state& state, const move& move_to_check, 
+    const lookup_tables_wrap& lookup_tables) {
+    // Color is the side to move, the move comes from the move generation of this position
+
+    constexpr int own = 6*Color;
+    constexpr int forward = Color ? -8 : 8;
+    constexpr int back_rank = 56*Color;
+
+    int from_position = move_to_check.from_position();
+    int to_position = move_to_check.to_position();
+    int piece_index = state.piece_on_square[from_position];
+    int opponent_king_position = __builtin_ctzll(state.type_bitboards[5] & state.color_bitboards[!Color]);
+    U64 opponent_king = 1ULL << opponent_king_position;
+
+    // direct check, a promoted piece attacks from the to position with the pawn gone from the from position
+    if (move_to_check.promotion()) {
+        U64 occupancy_bitboard = (state.occupancy ^ (1ULL << from_position)) | (1ULL << to_position);
+        U64 attacks = 0;
+        switch (move_to_check.promotion_type()) {
+            case 1: attacks = lookup_tables.knight_lookup_table[to_position]; break;
+            case 2: attacks = bishop_attacks(lookup_tables, to_position, occupancy_bitboard); break;
+            case 3: attacks = rook_attacks(lookup_tables, to_position, occupancy_bitboard); break;
+            case 4: attacks = bishop_attacks(lookup_tables, to_position, occupancy_bitboard) | rook_attacks(lookup_tables, to_position, occupancy_bitboard); break;
+        }
+        if (attacks & opponent_king) {
+            return true;
+        }
+    }
+    else if (state.info.check_squares[piece_index - own] & (1ULL << to_position)) {
+        return true;
+    }
 
-    // get attacked bitboard
-    U64 attacked_bitboard = attacked(state, color, lookup_tables, get_occupancy(state.piece_bitboards));
+    // discovered check, a blocker of the opponent king leaves the line between the king and the slider
+    if ((state.info.blockers[!Color] & (1ULL << from_position)) &&
+        !(lookup_tables.line_table[opponent_king_position][from_position] & (1ULL << to_position))) {
+        return true;
+    }
 
-    // get the king position
-    int king_position;
-    U64 king_bitboard = state.piece_bitboards[11 - 6*color];
+    // the rook of a castling move can give check
+    if (move_to_check.castling()) {
+        int rook_from = to_position == back_rank + 2 ? back_rank : back_rank + 7;
+        int rook_to = to_position == back_rank + 2 ? back_rank + 3 : back_rank + 5;
+        U64 occupancy_bitboard = (state.occupancy ^ (1ULL << from_position) ^ (1ULL << rook_from)) | (1ULL << to_position) | (1ULL << rook_to);
+        return rook_attacks(lookup_tables, rook_to, occupancy_bitboard) & opponent_king;
+    }
 
-    // check if the king is attacked
-    return !(attacked_bitboard & king_bitboard);
+    // the pawn captured en passant can uncover a slider
+    if (piece_index == own && to_position == state.en_passant_square) {
+        U64 occupancy_bitboard = (state.occupancy ^ (1ULL << from_position) ^ (1ULL << (to_position - forward))) | (1ULL << to_position);
+        U64 own_pieces = state.color_bitboards[Color];
+        U64 bishops_queens = (state.type_bitboards[2] | state.type_bitboards[4]) & own_pieces;
+        U64 rooks_queens = (state.type_bitboards[3] | state.type_bitboards[4]) & own_pieces;
+        return (bishop_attacks(lookup_tables, opponent_king_position, occupancy_bitboard) & bishops_queens) ||
+            (rook_attacks(lookup_tables, opponent_king_position, occupancy_bitboard) & rooks_queens);
+    }
+
+    return false;
 }
 
+// move generation and legality checks for both colors
+template int pseudo_legal_move_generator<false>(move_list&, const game_state&, lookup_tables_wrap&);
+template int pseudo_legal_move_generator<true>(move_list&, const game_state&, lookup_tables_wrap&);
+template bool pseudo_to_legal<false>(const game_state&, lookup_tables_wrap&);
+template bool pseudo_to_legal<true>(const game_state&, lookup_tables_wrap&);
+template void update_state_info<false>(game_state&, const lookup_tables_wrap&);
+template void update_state_info<true>(game_state&, const lookup_tables_wrap&);
+template bool legal<false>(const game_state&, const move&, const lookup_tables_wrap&);
+template bool legal<true>(const game_state&, const move&, const lookup_tables_wrap&);
+template bool gives_check<false>(const game_state&, const move&, const lookup_tables_wrap&);
+template bool gives_check<true>(const game_state&, const move&, const lookup_tables_wrap&);
+
 void generate_lookup_tables( 
     lookup_tables_wrap& lookup_tables) {
 
-    // create pawn move bitboards lookup table
-    // position + NUM_SQUARES*color as index
-    for (int i = 0; i < 64; i++) {
-        for (int j = 0; j < 2; j++) {
-            lookup_tables.pawn_move_lookup_table[i + 64*j] = get_pawn_move(i, j);
-        }
-    }
-
     // create pawn attack bitboards lookup table
     // position + NUM_SQUARES*color as index
     for (int i = 0; i < 64; i++) {
@@ -1244,38 +1115,53 @@ void generate_lookup_tables(
         lookup_tables.knight_lookup_table[i] = get_knight_attack(i);
     }
 
-    // create bishop attack bitboards lookup tables
-    // generate magics and lookup tables for each position
-    // position*MAGIC_TABLE_SIZE + index as index
+    // create bishop and rook attack bitboards lookup tables
+    // the squares are packed one after the other in the slider table
+    // offset + index as index
+    uint32_t offset = 0;
     for (int i = 0; i < 64; i++) {
-        U64 mask_bitboard = get_bishop_mask(i);
-        lookup_tables.bishop_mask_lookup_table[i] = mask_bitboard;
-        lookup_tables.bishop_mask_bit_count[i] = count_set_bits(mask_bitboard);
-        std::vector<U64> blocker_boards = get_blocker_boards(i, mask_bitboard);
-        std::vector<U64> attack_bitboards;
-        for (U64 blocker_board : blocker_boards) {
-            attack_bitboards.push_back(get_bishop_attack(i, blocker_board));
-        }
-        generate_magics(i, mask_bitboard, blocker_boards, attack_bitboards, lookup_tables.bishop_magics[i], lookup_tables.bishop_attack_lookup_table);
+        magic_entry& entry = lookup_tables.bishop_magics[i];
+        entry.mask = get_bishop_mask(i);
+        entry.magic = BISHOP_MAGICS[i];
+        entry.offset = offset;
+        entry.shift = 64 - count_set_bits(entry.mask);
+        offset += 1 << count_set_bits(entry.mask);
     }
 
-    // create rook attack bitboards lookup tables
-    // generate magics and lookup tables for each position
-    // position*MAGIC_TABLE_SIZE + index as index
     for (int i = 0; i < 64; i++) {
-        U64 mask_bitboard = get_rook_mask(i);
-        lookup_tables.rook_mask_lookup_table[i] = mask_bitboard;
-        lookup_tables.rook_mask_bit_count[i] = count_set_bits(mask_bitboard);
-        std::vector<U64> blocker_boards = get_blocker_boards(i, mask_bitboard);
-        std::vector<U64> attack_bitboards;
-        for (U64 blocker_board : blocker_boards) {
-            attack_bitboards.push_back(get_rook_attack(i, blocker_board));
-        }
-        generate_magics(i, mask_bitboard, blocker_boards, attack_bitboards, lookup_tables.rook_magics[i], lookup_tables.rook_attack_lookup_table);
+        magic_entry& entry = lookup_tables.rook_magics[i];
+        entry.mask = get_rook_mask(i);
+        entry.magic = ROOK_MAGICS[i];
+        entry.offset = offset;
+        entry.shift = 64 - count_set_bits(entry.mask);
+        offset += 1 << count_set_bits(entry.mask);
     }
 
+    fill_slider_table(lookup_tables);
+
     // create king attack bitboards lookup table
     for (int i = 0; i < 64; i++) {
         lookup_tables.king_lookup_table[i] = get_king_attack(i);
     }
+
+    // create between and line lookup tables
+    // two squares are aligned if a bishop or rook on one of them attacks the other on an empty board
+    for (int i = 0; i < 64; i++) {
+        for (int j = 0; j < 64; j++) {
+            U64 squares = (1ULL << i) | (1ULL << j);
+            lookup_tables.between_table[i][j] = 0;
+            lookup_tables.line_table[i][j] = 0;
+            if (i == j) {
+                continue;
+            }
+            if (get_bishop_attack(i, 0) & (1ULL << j)) {
+                lookup_tables.between_table[i][j] = get_bishop_attack(i, 1ULL << j) & get_bishop_attack(j, 1ULL << i);
+                lookup_tables.line_table[i][j] = (get_bishop_attack(i, 0) & get_bishop_attack(j, 0)) | squares;
+            }
+            else if (get_rook_attack(i, 0) & (1ULL << j)) {
+                lookup_tables.between_table[i][j] = get_rook_attack(i, 1ULL << j) & get_rook_attack(j, 1ULL << i);
+                lookup_tables.line_table[i][j] = (get_rook_attack(i, 0) & get_rook_attack(j, 0)) | squares;
+            }
+        }
+    }
 }
\ No newline at end of file
@@ -1,63 +1,203 @@
 #include <iostream>
 #include <array>
+#include <algorithm>
 #include <vector>
 #include <random>
 #include <bitset>
-#include "evaluation.h"
+#include <cstdint>
 
 // aliases and global constants
 using U64 = unsigned long long;
-constexpr int MAGIC_TABLE_SIZE = 4096;
 constexpr int NUM_SQUARES = 64;
 constexpr int NUM_PIECES = 12;
+constexpr U64 FILE_A_MASK = 0x0101010101010101ULL;
+constexpr U64 FILE_H_MASK = FILE_A_MASK << 7;
+constexpr U64 RANK_1_MASK = 0xFFULL;
+constexpr U64 RANK_8_MASK = RANK_1_MASK << 56;
 
 // struct declarations
 
+// fancy magic bitboards
+// the attack sets of every slider square are packed densely into one shared table
+// a square takes 2^(mask bits) entries, at most 512 for a bishop and 4096 for a rook
+// everything a lookup needs about a square is in one 32 byte entry, so it reads a single line of metadata
+constexpr int BISHOP_TABLE_SIZE = 5248;
+constexpr int ROOK_TABLE_SIZE = 102400;
+constexpr int SLIDER_TABLE_SIZE = BISHOP_TABLE_SIZE + ROOK_TABLE_SIZE;
+
+struct alignas(32) magic_entry {
+    U64 mask;
+    U64 magic;
+    uint32_t offset;    // first entry of the square in the slider table
+    uint32_t shift;     // 64 - number of mask bits
+};
+
 // lookup tables
 struct lookup_tables_wrap {
-    std::array<U64, 128> pawn_move_lookup_table;
     std::array<U64, 128> pawn_attack_lookup_table; 
     std::array<U64, 64> knight_lookup_table; 
-    std::array<U64, 64> bishop_magics;
-    std::array<U64, 64> bishop_mask_lookup_table; 
-    std::array<U64, 64> bishop_mask_bit_count;
-    std::array<U64, 262144> bishop_attack_lookup_table;
-    std::array<U64, 64> rook_magics; 
-    std::array<U64, 64> rook_mask_lookup_table;
-    std::array<U64, 64> rook_mask_bit_count;
-    std::array<U64, 262144> rook_attack_lookup_table;
+    std::array<magic_entry, 64> bishop_magics;
+    std::array<magic_entry, 64> rook_magics;
+    std::array<U64, SLIDER_TABLE_SIZE> slider_attack_table;
     std::array<U64, 64> king_lookup_table;
+
+    // the squares between two squares on a rank, file or diagonal, without the two squares
+    // and the whole line through them, with the two squares; both are empty for squares that are not aligned
+    std::array<std::array<U64, 64>, 64> between_table;
+    std::array<std::array<U64, 64>, 64> line_table;
 };
 
+// slider attack backends, both index the same packed slider table
+// magic: multiply-shift indexing, runs on every CPU
+// pext: the BMI2 pext instruction gathers the blocker bits directly, used where it is fast (not on AMD before Zen 3)
+// the backend is chosen once at startup, the slider table has to be filled for the backend in use (fill_slider_table)
+extern bool use_pext;
+bool has_fast_pext();
+
+inline U64 pext(U64 bitboard, U64 mask) {
+    // the instruction is emitted directly, so it can be inlined into code that is not compiled for BMI2
+    U64 result;
+    asm("pextq %2, %1, %0" : "=r"(result) : "r"(bitboard), "rm"(mask));
+    return result;
+}
+
+inline U64 slider_index(const magic_entry& entry, U64 occupancy_bitboard) {
+    if (use_pext) {
+        return pext(occupancy_bitboard, entry.mask);
+    }
+    return ((occupancy_bitboard & entry.mask) * entry.magic) >> entry.shift;
+}
+
+inline U64 slider_attacks(const lookup_tables_wrap& lookup_tables, const magic_entry& entry, U64 occupancy_bitboard) {
+    return lookup_tables.slider_attack_table[entry.offset + slider_index(entry, occupancy_bitboard)];
+}
+
+inline U64 bishop_attacks(const lookup_tables_wrap& lookup_tables, int position, U64 occupancy_bitboard) {
+    return slider_attacks(lookup_tables, lookup_tables.bishop_magics[position], occupancy_bitboard);
+}
+
+inline U64 rook_attacks(const lookup_tables_wrap& lookup_tables, int position, U64 occupancy_bitboard) {
+    return slider_attacks(lookup_tables, lookup_tables.rook_magics[position], occupancy_bitboard);
+}
+
 // game state
+// a piece index is type + 6*color, with the types pawn, knight, bishop, rook, queen, king and white = 0
+// the pieces are kept as one bitboard per type and one per color, a piece bitboard is their intersection
+// the occupancy and the mailbox are kept next to them, make/unmake updates all of them with every piece
+constexpr int8_t NO_PIECE = -1;
+
+// the en passant square is the square behind a pawn that was just pushed twice
+// it is only set when an opponent pawn stands next to the pushed pawn, so it can be captured
+constexpr int8_t NO_SQUARE = -1;
+
+// castling rights, one bit per right
+constexpr int WHITE_SHORT_CASTLE = 1;
+constexpr int WHITE_LONG_CASTLE = 2;
+constexpr int BLACK_SHORT_CASTLE = 4;
+constexpr int BLACK_LONG_CASTLE = 8;
+constexpr int ALL_CASTLING = 15;
+
+// the castling rights that are kept when a piece moves from or to a square
+// rights = rights & castle_mask[from] & castle_mask[to] covers king moves, rook moves and captured rooks
+constexpr std::array<uint8_t, 64> castle_mask = [] {
+    std::array<uint8_t, 64> mask{};
+    for (int position = 0; position < 64; position++) {
+        mask[position] = ALL_CASTLING;
+    }
+    mask[0] = ALL_CASTLING & ~WHITE_LONG_CASTLE;
+    mask[4] = ALL_CASTLING & ~(WHITE_LONG_CASTLE | WHITE_SHORT_CASTLE);
+    mask[7] = ALL_CASTLING & ~WHITE_SHORT_CASTLE;
+    mask[56] = ALL_CASTLING & ~BLACK_LONG_CASTLE;
+    mask[60] = ALL_CASTLING & ~(BLACK_LONG_CASTLE | BLACK_SHORT_CASTLE);
+    mask[63] = ALL_CASTLING & ~BLACK_SHORT_CASTLE;
+    return mask;
+}();
+
+// the checks of a position, computed once per position for the side to move by update_state_info
+// apply_move keeps the info of the parent in the move undo object and undo_move puts it back
+struct state_info {
+    U64 checkers = 0;                       // the opponent pieces that give check to the side to move
+    std::array<U64, 2> blockers{};          // per king color, the pieces of both colors that are the only piece between the king and an opponent slider
+    std::array<U64, 2> pinned{};            // per color, the blockers of its own king that are its own pieces
+    std::array<U64, 6> check_squares{};     // per piece type, the squares from which a piece of the side to move gives check
+};
+
 struct game_state {
-    std::array<U64, 12> piece_bitboards;
-    std::array<U64, 2> en_passant_bitboards;
-    bool w_long_castle;
-    bool w_short_castle;
-    bool b_long_castle;
-    bool b_short_castle;
+    std::array<U64, 6> type_bitboards{};
+    std::array<U64, 2> color_bitboards{};
+    U64 occupancy = 0;
+    std::array<int8_t, 64> piece_on_square;
+    int8_t en_passant_square;
+    uint8_t castling_rights;
+    state_info info;
 
     // constructor
-    game_state(const std::array<U64, 12>& piece_bb, 
-        const std::array<U64, 2>& en_passant_bb,
-        bool wlc, bool wsc, bool blc, bool bsc) 
-        : piece_bitboards(piece_bb),
-        en_passant_bitboards(en_passant_bb),
-        w_long_castle(wlc),
-        w_short_castle(wsc),
-        b_long_castle(blc),
-        b_short_castle(bsc) {}
-    };
+    game_state(const std::array<U64, 12>& piece_bb, int en_passant_sq, int castling) 
+        : en_passant_square(en_passant_sq),
+        castling_rights(castling) {
+        piece_on_square.fill(NO_PIECE);
+        for (int piece_index = 0; piece_index < 12; piece_index++) {
+            for (U64 bitboard = piece_bb[piece_index]; bitboard; bitboard &= bitboard - 1) {
+                add_piece(piece_index, __builtin_ctzll(bitboard));
+            }
+        }
+    }
+
+    U64 piece_bitboard(int piece_index) const {
+        return type_bitboards[piece_index % 6] & color_bitboards[piece_index >= 6];
+    }
+
+    // the 12 piece bitboards, for the evaluation code that works on them
+    std::array<U64, 12> piece_bitboards() const {
+        std::array<U64, 12> piece_bb;
+        for (int piece_index = 0; piece_index < 12; piece_index++) {
+            piece_bb[piece_index] = piece_bitboard(piece_index);
+        }
+        return piece_bb;
+    }
+
+    void add_piece(int piece_index, int position) {
+        U64 bit = 1ULL << position;
+        type_bitboards[piece_index % 6] |= bit;
+        color_bitboards[piece_index >= 6] |= bit;
+        occupancy |= bit;
+        piece_on_square[position] = piece_index;
+    }
+
+    void remove_piece(int piece_index, int position) {
+        U64 bit = 1ULL << position;
+        type_bitboards[piece_index % 6] &= ~bit;
+        color_bitboards[piece_index >= 6] &= ~bit;
+        occupancy &= ~bit;
+        piece_on_square[position] = NO_PIECE;
+    }
+
+    void move_piece(int piece_index, int from, int to) {
+        U64 from_to = (1ULL << from) | (1ULL << to);
+        type_bitboards[piece_index % 6] ^= from_to;
+        color_bitboards[piece_index >= 6] ^= from_to;
+        occupancy ^= from_to;
+        piece_on_square[from] = NO_PIECE;
+        piece_on_square[to] = piece_index;
+    }
+
+    // the pawns of a color next to a position, they can capture a pawn on it en passant
+    U64 en_passant_attackers(int position, bool color) const {
+        U64 bit = 1ULL << position;
+        U64 neighbours = ((bit << 1) & ~FILE_A_MASK) | ((bit >> 1) & ~FILE_H_MASK);
+        return neighbours & type_bitboards[0] & color_bitboards[color];
+    }
+
+    U64 en_passant_bitboard() const {
+        return en_passant_square == NO_SQUARE ? 0 : 1ULL << en_passant_square;
+    }
+};
 
 // zobrist hashing randoms
 struct zobrist_randoms {
     std::array<U64, 768> zobrist_piece_table{};
     U64 zobrist_black_to_move = 0;
-    U64 zobrist_w_long_castle = 0;
-    U64 zobrist_w_short_castle = 0;
-    U64 zobrist_b_long_castle = 0;
-    U64 zobrist_b_short_castle = 0;
+    std::array<U64, 16> zobrist_castling{};   // one key per castling rights value
     std::array<U64, 8> zobrist_en_passant{};
 
     // default constructor
@@ -65,34 +205,102 @@ struct zobrist_randoms {
 };
 
 // move object
+// 16 bits: from square (bits 0-5), to square (bits 6-11) and a flag (bits 12-15)
+// the moving piece is not stored, make/unmake read it from the mailbox
+// a promotion flag holds the type of the new piece in its low 2 bits, knight (1) to queen (4)
+constexpr int NORMAL_MOVE = 0;
+constexpr int DOUBLE_PAWN_PUSH = 1;     // the pawn becomes en passantable
+constexpr int CASTLING = 2;
+constexpr int PROMOTION = 4;
+
 struct move {
-    uint8_t piece_index;
-    uint8_t from_position;
-    uint8_t to_position;
-    uint8_t promotion_piece_index;
-    bool en_passantable;
-    bool castling;
+    uint16_t data = 0;
 
-    // default constructor
-    move() : piece_index(-1), from_position(-1), to_position(-1), promotion_piece_index(-1), en_passantable(false), castling(false) {}
+    // default constructor, a1a1 is never a move
+    move() = default;
 
     // constructor
-    move(uint8_t piece_index, uint8_t from_position, uint8_t to_position, 
-        uint8_t promotion_piece_index, bool en_passantable, bool castling) 
-       : piece_index(piece_index), from_position(from_position), to_position(to_position), 
-         promotion_piece_index(promotion_piece_index), en_passantable(en_passantable), castling(castling) {}
+    move(int from_position, int to_position, int flag = NORMAL_MOVE)
+        : data(from_position | to_position << 6 | flag << 12) {}
+
+    int from_position() const { return data & 63; }
+    int to_position() const { return (data >> 6) & 63; }
+    int flag() const { return data >> 12; }
+    bool en_passantable() const { return flag() == DOUBLE_PAWN_PUSH; }
+    bool castling() const { return flag() == CASTLING; }
+    bool promotion() const { return flag() & PROMOTION; }
+    int promotion_type() const { return (flag() & 3) + 1; }
+
+    bool operator==(const move& other) const { return data == other.data; }
+    bool operator!=(const move& other) const { return data != other.data; }
+};
+
+// fixed capacity move list, every move is stored with its move ordering score
+constexpr int MAX_MOVES = 256;
+
+struct scored_move {
+    move m;
+    int score;
+};
+
+struct move_list {
+    std::array<scored_move, MAX_MOVES> entries;
+    int size = 0;
+
+    void add(move m) {
+        entries[size].m = m;
+        size++;
+    }
+
+    move& operator[](int i) { return entries[i].m; }
+    const move& operator[](int i) const { return entries[i].m; }
+
+    // highest score first
+    void sort() {
+        std::sort(entries.begin(), entries.begin() + size, [](const scored_move& a, const scored_move& b) {
+            return a.score > b.score;
+        });
+    }
 };
 
 //move undo object
 struct move_undo {
     U64 zobrist_hash;
-    bool w_long_castle;
-    bool w_short_castle;
-    bool b_long_castle;
-    bool b_short_castle;
-    bool en_passant;
-    U64 en_passant_bitboards[2];
-    int captured_piece_index; // -1 if no piece was captured
+    uint8_t castling_rights;
+    int8_t en_passant_square;
+    int8_t captured_piece_index; // -1 if no piece was captured
+    state_info info;                // of the position before the move
+};
+
+// what apply_move prefetches for the child position
+// the search passes its transposition table when the child probes it, so the entry is on its way to the cache while the move is checked for legality
+// a leaf does not probe the table, it is evaluated, and the evaluation policy prefetches what the evaluation reads instead
+// an empty hint prefetches nothing
+struct prefetch_hint {
+    const char* table = nullptr;
+    size_t entry_size = 0;
+    U64 mask = 0;
+    bool evaluate = false;
+
+    void prefetch(U64 hash) const {
+        if (table) {
+            __builtin_prefetch(table + (hash & mask)*entry_size);
+        }
+    }
+};
+
+// evaluation policies
+// make/unmake and the search are instantiated once per policy, so the evaluation is chosen at compile time
+// apply_move reports every ply and every changed piece to the policy, undo_move pops the ply again
+// once the new position is complete, the policy can prefetch what its evaluation of the position will read
+// the policies of the engine are in position_evaluation.h
+
+// no evaluation, make/unmake only keep the position, used by perft
+struct no_eval {
+    void push() {}
+    void pop() {}
+    void add_dirty_piece(int piece_index, int from, int to) {}
+    void prefetch(const game_state& state, U64 hash) const {}
 };
 
 
@@ -101,9 +309,6 @@ void visualize_game_state_2(const game_state& state);
 
 // usefull functions
 
-U64 combine_white(const std::array<U64, 12>& piece_bitboards);
-U64 combine_black(const std::array<U64, 12>& piece_bitboards);
-U64 get_occupancy(const std::array<U64, 12>& piece_bitboards);
 std::vector<int> get_set_bit_positions(U64 bitboard);
 int pop_lsb(U64& bitboard);
 int count_set_bits(U64 bitboard);
@@ -112,14 +317,10 @@ bool is_bit_set(U64 bitboard, int position);
 // magic bitboards
 
 std::vector<U64> get_blocker_boards(int position, U64 mask_bitboard);
-U64 generate_candidate_magic();
-void generate_magics(int position, U64 mask_bitboard, std::vector<U64> blocker_boards, 
-    std::vector<U64> attack_bitboards, U64& candidate_magic, std::array<U64, 4096>& lookup_table);
 
 // lookup table initialization functions
 
 // pawn
-U64 get_pawn_move(int position, bool color);
 U64 get_pawn_attack(int position, bool color);
 
 // knight
@@ -138,21 +339,120 @@ U64 get_king_attack(int position);
 
 // move generation
 
-U64 attacked(game_state state, bool color, 
-    lookup_tables_wrap& lookup_tables,
-    const U64& occupancy_bitboard);
-int pseudo_legal_move_generator(std::array<move, 256>& moves,
-    game_state& state, bool color, 
-    lookup_tables_wrap& lookup_tables,
-    const U64& occupancy_bitboard);
-U64 init_zobrist_hashing_mailbox(game_state &state, zobrist_randoms &zobrist, bool color, std::array<int, 64>& piece_on_square);
+// the color is a template parameter, so the color dependent shifts, masks and piece indices are constants
+// the search calls the template of the side to move, the overloads with a color argument dispatch to it for the other callers
+template <bool Color>
+int pseudo_legal_move_generator(move_list& moves,
+    const game_state& state, 
+    lookup_tables_wrap& lookup_tables);
+U64 init_zobrist_hashing(const game_state &state, zobrist_randoms &zobrist, bool color);
+U64 compute_zobrist_hash(const game_state &state, const zobrist_randoms &zobrist, bool color);
 int alternative_position(int position);
 int alternative_piece(int piece_index);
-void apply_move(game_state& state, move& move_to_apply, U64& zobrist_hash, zobrist_randoms &zobrist, move_undo& undo, std::array<int, 64>& piece_on_square,
-const linear_layer<INPUT_SIZE, HIDDEN1_SIZE>& layer1, NNUE_accumulator& accumulator);
-void undo_move(game_state& state, move& move_to_undo, U64& zobrist_hash, zobrist_randoms &zobrist, move_undo& undo, std::array<int, 64>& piece_on_square,
-const linear_layer<INPUT_SIZE, HIDDEN1_SIZE>& layer1, NNUE_accumulator& accumulator);
-bool pseudo_to_legal(game_state& state, bool color, 
-    lookup_tables_wrap& lookup_tables,
-    const U64& occupancy_bitboard);
-void generate_lookup_tables(lookup_tables_wrap& lookup_tables);
\ No newline at end of file
+template <bool Color, typename Eval>
+void apply_move(game_state& state, move& move_to_apply, U64& zobrist_hash, zobrist_randoms &zobrist, move_undo& undo,
+Eval& eval, const prefetch_hint& hint = prefetch_hint{});
+template <bool Color, typename Eval>
+void undo_move(game_state& state, move& move_to_undo, U64& zobrist_hash, move_undo& undo,
+Eval& eval);
+template <bool Color>
+bool pseudo_to_legal(const game_state& state, 
+    lookup_tables_wrap& lookup_tables);
+
+// checks, pins and check squares of a position, Color is the side to move
+// the search and perft call it when they enter a position that is not a leaf, the leaves do not need it
+template <bool Color>
+void update_state_info(game_state& state, 
+    const lookup_tables_wrap& lookup_tables);
+
+// whether a pseudo-legal move of the side to move is legal, from the state info, without making it
+template <bool Color>
+bool legal(const game_state& state, const move& move_to_check, 
+    const lookup_tables_wrap& lookup_tables);
+
+// whether a pseudo-legal move of the side to move gives check, from the state info, without making it
+template <bool Color>
+bool gives_check(const game_state& state, const move& move_to_check, 
+    const lookup_tables_wrap& lookup_tables);
+
+// the pieces of both colors that attack a position, with the sliders blocked by the given occupancy
+// reverse lookup: a piece attacks the position if the same piece on the position attacks it
+// pawns attack in one direction, a white pawn attacks the position if a black pawn on the position would attack the white pawn
+inline U64 attackers_to(const game_state& state, int position, U64 occupancy_bitboard, 
+    const lookup_tables_wrap& lookup_tables) {
+    U64 bishops_queens = state.type_bitboards[2] | state.type_bitboards[4];
+    U64 rooks_queens = state.type_bitboards[3] | state.type_bitboards[4];
+    return (lookup_tables.pawn_attack_lookup_table[position + NUM_SQUARES] & state.type_bitboards[0] & state.color_bitboards[0])
+        | (lookup_tables.pawn_attack_lookup_table[position] & state.type_bitboards[0] & state.color_bitboards[1])
+        | (lookup_tables.knight_lookup_table[position] & state.type_bitboards[1])
+        | (bishop_attacks(lookup_tables, position, occupancy_bitboard) & bishops_queens)
+        | (rook_attacks(lookup_tables, position, occupancy_bitboard) & rooks_queens)
+        | (lookup_tables.king_lookup_table[position] & state.type_bitboards[5]);
+}
+
+// whether a position is attacked by the given color
+// the cheap lookups go first, the sliders are only looked up if no pawn, knight or king attacks the position
+template <bool Color>
+inline bool is_square_attacked(const game_state& state, int position, 
+    const lookup_tables_wrap& lookup_tables) {
+    U64 attackers = state.color_bitboards[Color];
+    if ((lookup_tables.pawn_attack_lookup_table[position + NUM_SQUARES*!Color] & state.type_bitboards[0] & attackers) ||
+        (lookup_tables.knight_lookup_table[position] & state.type_bitboards[1] & attackers) ||
+        (lookup_tables.king_lookup_table[position] & state.type_bitboards[5] & attackers)) {
+        return true;
+    }
+    U64 bishops_queens = (state.type_bitboards[2] | state.type_bitboards[4]) & attackers;
+    U64 rooks_queens = (state.type_bitboards[3] | state.type_bitboards[4]) & attackers;
+    return (bishop_attacks(lookup_tables, position, state.occupancy) & bishops_queens) ||
+        (rook_attacks(lookup_tables, position, state.occupancy) & rooks_queens);
+}
+
+inline int pseudo_legal_move_generator(move_list& moves,
+    const game_state& state, bool color, 
+    lookup_tables_wrap& lookup_tables) {
+    return color ? pseudo_legal_move_generator<true>(moves, state, lookup_tables) : pseudo_legal_move_generator<false>(moves, state, lookup_tables);
+}
+
+// the color of the move is the color of the moving piece, on its from position before the move and on its to position after it
+template <typename Eval>
+void apply_move(game_state& state, move& move_to_apply, U64& zobrist_hash, zobrist_randoms &zobrist, move_undo& undo,
+Eval& eval, const prefetch_hint& hint = prefetch_hint{}) {
+    if (state.piece_on_square[move_to_apply.from_position()] < 6) {
+        apply_move<false>(state, move_to_apply, zobrist_hash, zobrist, undo, eval, hint);
+    }
+    else {
+        apply_move<true>(state, move_to_apply, zobrist_hash, zobrist, undo, eval, hint);
+    }
+}
+
+template <typename Eval>
+void undo_move(game_state& state, move& move_to_undo, U64& zobrist_hash, move_undo& undo,
+Eval& eval) {
+    if (state.piece_on_square[move_to_undo.to_position()] < 6) {
+        undo_move<false>(state, move_to_undo, zobrist_hash, undo, eval);
+    }
+    else {
+        undo_move<true>(state, move_to_undo, zobrist_hash, undo, eval);
+    }
+}
+
+inline bool pseudo_to_legal(const game_state& state, bool color, 
+    lookup_tables_wrap& lookup_tables) {
+    return color ? pseudo_to_legal<true>(state, lookup_tables) : pseudo_to_legal<false>(state, lookup_tables);
+}
+
+inline void update_state_info(game_state& state, bool color, 
+    const lookup_tables_wrap& lookup_tables) {
+    color ? update_state_info<true>(state, lookup_tables) : update_state_info<false>(state, lookup_tables);
+}
+
+inline bool legal(const game_state& state, const move& move_to_check, bool color, 
+    const lookup_tables_wrap& lookup_tables) {
+    return color ? legal<true>(state, move_to_check, lookup_tables) : legal<false>(state, move_to_check, lookup_tables);
+}
+
+// deterministic, the magics are constants, so this only takes a few milliseconds
+void generate_lookup_tables(lookup_tables_wrap& lookup_tables);
+
+// fill the slider table from the masks and magics, for the backend in use
+void fill_slider_table(lookup_tables_wrap& lookup_tables);
\ No newline at end of file
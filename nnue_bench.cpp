@@ -0,0 +1,250 @@
+#include "evaluation.h"
+#include <chrono>
+
+// NNUE inference benchmark
+// first checks that every instruction set the CPU supports computes exactly what the scalar kernels compute,
+// position by position on the bench and perft positions, and that the batch evaluation matches the single evaluation
+// then measures accumulator updates and evaluations per second for every instruction set
+// exits with 1 at the first mismatch
+// g++ nnue_bench.cpp evaluation.cpp evaluation_simd.cpp -O3 -o nnue_bench
+
+constexpr int NUM_EVALUATIONS = 1000000;
+
+// bench and perft positions
+const std::array<std::string, 10> TEST_POSITIONS = {
+    "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+    "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+    "r1bq1rk1/pp2bppp/2n1pn2/3p4/2PP4/2N1PN2/PP3PPP/R2QKB1R w KQ - 0 8",
+    "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10",
+    "2kr3r/ppp2ppp/2n5/2b1q3/4P3/2N1BQ2/PPP2PPP/R4RK1 b - - 0 14",
+    "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+    "8/5pk1/6p1/3Q4/8/6P1/5PK1/1q6 w - - 0 40",
+    "6k1/5ppp/8/8/8/8/1Q3PPP/R5K1 w - - 0 1",
+    "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1",
+    "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8"};
+
+// random float network, only the speed and the agreement between kernels matter here
+void random_layers(linear_layer<FEATURE_SIZE, HIDDEN1_SIZE>& layer1, linear_layer<HIDDEN1_SIZE*2, HIDDEN2_SIZE>& layer2,
+    linear_layer<HIDDEN2_SIZE, HIDDEN3_SIZE>& layer3, linear_layer<HIDDEN3_SIZE, NUM_OUTPUT_BUCKETS*OUTPUT_SIZE>& layer4) {
+
+    std::mt19937 rng(42);
+    std::normal_distribution<float> dist(0.0f, 1.0f);
+
+    for (auto& row : layer1.weights) for (float& w : row) w = dist(rng) * 0.1f;
+    for (float& b : layer1.biases) b = 0.3f + dist(rng) * 0.1f;
+    for (auto& row : layer2.weights) for (float& w : row) w = dist(rng) * 0.05f;
+    for (float& b : layer2.biases) b = dist(rng) * 0.1f;
+    for (auto& row : layer3.weights) for (float& w : row) w = dist(rng) * 0.3f;
+    for (float& b : layer3.biases) b = 0.2f;
+    for (auto& row : layer4.weights) for (float& w : row) w = dist(rng) * 200.0f;
+    for (float& b : layer4.biases) b = 0.0f;
+}
+
+// piece placement and side to move of a FEN string
+nnue_position fen_to_position(const std::string& fen) {
+    const std::string piece_letters = "PNBRQKpnbrqk";
+    nnue_position position{};
+
+    int square = 56;
+    size_t i = 0;
+    for (; fen[i] != ' '; i++) {
+        if (fen[i] == '/') {
+            square -= 16;
+        }
+        else if (fen[i] >= '1' && fen[i] <= '8') {
+            square += fen[i] - '0';
+        }
+        else {
+            position.piece_bitboards[piece_letters.find(fen[i])] |= 1ULL << square;
+            square++;
+        }
+    }
+    position.color = fen[i + 1] == 'b';
+
+    return position;
+}
+
+// active features of both perspectives
+void active_features(const nnue_position& position, std::vector<int>& features_w, std::vector<int>& features_b) {
+    int key_w = king_key(__builtin_ctzll(position.piece_bitboards[5]), false);
+    int key_b = king_key(__builtin_ctzll(position.piece_bitboards[11]), true);
+    for (int piece_index = 0; piece_index < 12; piece_index++) {
+        for (U64 bitboard = position.piece_bitboards[piece_index]; bitboard; bitboard &= bitboard - 1) {
+            features_w.push_back(feature_index(piece_index, __builtin_ctzll(bitboard), false, key_w));
+            features_b.push_back(feature_index(piece_index, __builtin_ctzll(bitboard), true, key_b));
+        }
+    }
+}
+
+int piece_count(const nnue_position& position) {
+    int count = 0;
+    for (U64 bitboard : position.piece_bitboards) {
+        count += __builtin_popcountll(bitboard);
+    }
+    return count;
+}
+
+// everything the active kernels compute for a position
+// the accumulator from scratch, the accumulator after removing the first piece, and the score of every output bucket for both sides
+struct kernel_outputs {
+    quantized_accumulator refreshed;
+    quantized_accumulator updated;
+    std::array<std::array<int, NUM_OUTPUT_BUCKETS>, 2> scores;
+};
+
+void compute_outputs(const quantized_network& network, const nnue_position& position, kernel_outputs& outputs) {
+    std::vector<int> features_w;
+    std::vector<int> features_b;
+    active_features(position, features_w, features_b);
+
+    refresh_accumulator(network.layer1, outputs.refreshed, features_w, features_b);
+    for (int color = 0; color < 2; color++) {
+        for (int bucket = 0; bucket < NUM_OUTPUT_BUCKETS; bucket++) {
+            outputs.scores[color][bucket] = nnue_evaluation(outputs.refreshed, network, color, bucket);
+        }
+    }
+
+    outputs.updated = outputs.refreshed;
+    update_accumulator(network.layer1, outputs.updated, {features_w[0]}, {}, {features_b[0]}, {});
+}
+
+// compare every kernel set with the scalar kernels, position by position
+bool check_kernels(const quantized_network& network, const std::vector<nnue_position>& positions) {
+    std::vector<kernel_outputs> expected(positions.size());
+    active_kernels = &scalar_kernels;
+    for (size_t p = 0; p < positions.size(); p++) {
+        compute_outputs(network, positions[p], expected[p]);
+    }
+
+    std::vector<kernel_outputs> actual(1);
+    for (const simd_kernels* kernels : supported_kernels()) {
+        active_kernels = kernels;
+        for (size_t p = 0; p < positions.size(); p++) {
+            compute_outputs(network, positions[p], actual[0]);
+
+            if (actual[0].refreshed.values != expected[p].refreshed.values) {
+                std::cout << kernels->name << ": refreshed accumulator differs from scalar in " << TEST_POSITIONS[p] << std::endl;
+                return false;
+            }
+            if (actual[0].updated.values != expected[p].updated.values) {
+                std::cout << kernels->name << ": updated accumulator differs from scalar in " << TEST_POSITIONS[p] << std::endl;
+                return false;
+            }
+            for (int color = 0; color < 2; color++) {
+                for (int bucket = 0; bucket < NUM_OUTPUT_BUCKETS; bucket++) {
+                    if (actual[0].scores[color][bucket] != expected[p].scores[color][bucket]) {
+                        std::cout << kernels->name << ": score " << actual[0].scores[color][bucket] << " instead of " << expected[p].scores[color][bucket]
+                            << " in " << TEST_POSITIONS[p] << ", side to move " << color << ", bucket " << bucket << std::endl;
+                        return false;
+                    }
+                }
+            }
+        }
+        std::cout << kernels->name << ": " << positions.size() << " positions, " << NUM_OUTPUT_BUCKETS << " buckets, same as scalar" << std::endl;
+    }
+
+    return true;
+}
+
+// compare the batch evaluation with the single position evaluation, with one and with several threads
+// the positions are repeated with both sides to move, so there are full and partial blocks
+bool check_batch(const quantized_network& network, const std::vector<nnue_position>& test_positions) {
+    std::vector<nnue_position> positions;
+    while (positions.size() < 3*BATCH_BLOCK_SIZE) {
+        for (nnue_position position : test_positions) {
+            positions.push_back(position);
+            position.color = !position.color;
+            positions.push_back(position);
+        }
+    }
+
+    for (const simd_kernels* kernels : supported_kernels()) {
+        active_kernels = kernels;
+
+        std::vector<int> expected(positions.size());
+        quantized_accumulator accumulator;
+        for (size_t p = 0; p < positions.size(); p++) {
+            std::vector<int> features_w;
+            std::vector<int> features_b;
+            active_features(positions[p], features_w, features_b);
+            refresh_accumulator(network.layer1, accumulator, features_w, features_b);
+            expected[p] = nnue_evaluation(accumulator, network, positions[p].color, output_bucket(piece_count(positions[p])));
+        }
+
+        for (int num_threads : {1, 4}) {
+            std::vector<int> scores(positions.size());
+            nnue_evaluate_batch(network, positions.data(), scores.data(), positions.size(), num_threads);
+            for (size_t p = 0; p < positions.size(); p++) {
+                if (scores[p] != expected[p]) {
+                    std::cout << kernels->name << ": batch score " << scores[p] << " instead of " << expected[p]
+                        << " for position " << p << " with " << num_threads << " threads" << std::endl;
+                    return false;
+                }
+            }
+        }
+        std::cout << kernels->name << ": batch of " << positions.size() << " positions, same as single evaluation" << std::endl;
+    }
+
+    return true;
+}
+
+int main() {
+
+    // heap allocated, the layers are too large for the stack
+    std::vector<linear_layer<FEATURE_SIZE, HIDDEN1_SIZE>> layer1(1);
+    std::vector<linear_layer<HIDDEN1_SIZE*2, HIDDEN2_SIZE>> layer2(1);
+    std::vector<linear_layer<HIDDEN2_SIZE, HIDDEN3_SIZE>> layer3(1);
+    std::vector<linear_layer<HIDDEN3_SIZE, NUM_OUTPUT_BUCKETS*OUTPUT_SIZE>> layer4(1);
+    random_layers(layer1[0], layer2[0], layer3[0], layer4[0]);
+
+    std::vector<quantized_network> network_storage(1);
+    quantized_network& network = network_storage[0];
+    quantize_network(layer1[0], layer2[0], layer3[0], layer4[0], network);
+
+    std::vector<nnue_position> positions;
+    for (const std::string& fen : TEST_POSITIONS) {
+        positions.push_back(fen_to_position(fen));
+    }
+
+    if (!check_kernels(network, positions) || !check_batch(network, positions)) {
+        return 1;
+    }
+
+    // starting position features
+    std::vector<int> active_features_w;
+    std::vector<int> active_features_b;
+    active_features(positions[0], active_features_w, active_features_b);
+
+    // a knight moving back and forth, like make and unmake during a search
+    int key_w = king_key(4, false);
+    int key_b = king_key(60, true);
+    std::vector<int> g1_w = {feature_index(1, 6, false, key_w)}, f3_w = {feature_index(1, 21, false, key_w)};
+    std::vector<int> g1_b = {feature_index(1, 6, true, key_b)}, f3_b = {feature_index(1, 21, true, key_b)};
+
+    for (const simd_kernels* kernels : supported_kernels()) {
+        active_kernels = kernels;
+
+        quantized_accumulator accumulator;
+        refresh_accumulator(network.layer1, accumulator, active_features_w, active_features_b);
+
+        long long checksum = 0;
+        auto start = std::chrono::high_resolution_clock::now();
+
+        for (int i = 0; i < NUM_EVALUATIONS; i++) {
+            if (i % 2 == 0) {
+                update_accumulator(network.layer1, accumulator, g1_w, f3_w, g1_b, f3_b);
+            }
+            else {
+                update_accumulator(network.layer1, accumulator, f3_w, g1_w, f3_b, g1_b);
+            }
+            checksum += nnue_evaluation(accumulator, network, i % 2, output_bucket(32));
+        }
+
+        auto end = std::chrono::high_resolution_clock::now();
+        std::chrono::duration<double> duration = end - start;
+
+        std::cout << kernels->name << ": " << static_cast<long long>(NUM_EVALUATIONS / duration.count()) << " evals/s, checksum " << checksum << std::endl;
+    }
+
+    return 0;
+}
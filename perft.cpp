@@ -1,4 +1,4 @@
-#include "move_generation.h"
+#include "position_evaluation.h"
 #include <iostream>
 #include <array>
 #include <chrono>
@@ -49,7 +49,7 @@ void visualize_game_state(const game_state& state) {
 
     // Fill the board with pieces
     for (int i = 0; i < 12; ++i) {
-        U64 bitboard = state.piece_bitboards[i];
+        U64 bitboard = state.piece_bitboard(i);
         for (int square = 0; square < 64; ++square) {
             if (bitboard & (1ULL << square)) {
                 int row = 7 - (square / 8);
@@ -59,16 +59,11 @@ void visualize_game_state(const game_state& state) {
         }
     }
 
-    // Mark en passant squares
-    for (int i = 0; i < 2; ++i) {
-        U64 ep_board = state.en_passant_bitboards[i];
-        for (int square = 0; square < 64; ++square) {
-            if (ep_board & (1ULL << square)) {
-                int row = 7 - (square / 8);
-                int col = square % 8;
-                board[row][col] = '*';  // En passant target square
-            }
-        }
+    // Mark en passant square
+    if (state.en_passant_square != NO_SQUARE) {
+        int row = 7 - (state.en_passant_square / 8);
+        int col = state.en_passant_square % 8;
+        board[row][col] = '*';  // En passant target square
     }
 
     // Print the board
@@ -85,35 +80,37 @@ void visualize_game_state(const game_state& state) {
 
     // Print castling rights
     std::cout << "Castling rights: "
-              << (state.w_long_castle ? "Q" : "-")
-              << (state.w_short_castle ? "K" : "-")
-              << (state.b_long_castle ? "q" : "-")
-              << (state.b_short_castle ? "k" : "-") << "\n";
+              << (state.castling_rights & WHITE_LONG_CASTLE ? "Q" : "-")
+              << (state.castling_rights & WHITE_SHORT_CASTLE ? "K" : "-")
+              << (state.castling_rights & BLACK_LONG_CASTLE ? "q" : "-")
+              << (state.castling_rights & BLACK_SHORT_CASTLE ? "k" : "-") << "\n";
 }
 
 // perft
+// the color is a template parameter, every node calls the move generation and make/unmake of its side
 
-void perft(game_state& state, int depth, bool color, 
-    lookup_tables_wrap& lookup_tables,
-    const U64& occupancy_bitboard, int current_depth, 
+template <bool Color>
+void perft(game_state& state, int depth, 
+    lookup_tables_wrap& lookup_tables, int current_depth, 
     zobrist_randoms& zobrist, U64& zobrist_hash, 
-    std::array<std::array<move, 256>, 256>& moves_stack, 
-    std::array<move_undo, 256>& undo_stack, uint64_t& node_count,
-    std::array<int, 64>& piece_on_square) {
+    std::array<move_list, 256>& moves_stack, 
+    std::array<move_undo, 256>& undo_stack, uint64_t& node_count) {
 
     if (depth == 0) {
         node_count++;
         return;
     }
 
-    // Generate pseudo-legal moves
-    std::array<move, 256>& moves = moves_stack[current_depth];
-    int move_count = pseudo_legal_move_generator(moves, 
-        state, color, lookup_tables,
-        occupancy_bitboard);
+    // perft only counts positions, make/unmake does not have to keep an evaluation
+    no_eval eval;
 
-    std::array<int, 256> move_order;
-    std::array<int, 256> scores;
+    // the checks and pins of this position, the leaves do not need them
+    update_state_info<Color>(state, lookup_tables);
+
+    // Generate pseudo-legal moves
+    move_list& moves = moves_stack[current_depth];
+    int move_count = pseudo_legal_move_generator<Color>(moves, 
+        state, lookup_tables);
 
     // iterate over all pseudo-legal moves
     for (int i = 0; i < move_count; i++) {
@@ -121,44 +118,97 @@ void perft(game_state& state, int depth, bool color,
         int score = 0;
 
         // check for capture
-        int victim_index = piece_on_square[moves[i].to_position];
-        if (victim_index > 0) {
+        int victim_index = state.piece_on_square[moves[i].to_position()];
+        if (victim_index != NO_PIECE) {
             int victim_value = piece_values[victim_index%6];
-            int attacker_value = piece_values[moves[i].piece_index%6];
+            int attacker_value = piece_values[state.piece_on_square[moves[i].from_position()]%6];
             score = victim_value*10 - attacker_value;
         }
 
-        scores[i] = score;
-        move_order[i] = i; // store the index
+        moves.entries[i].score = score;
     }
 
     // sort moves based on scores
-    std::sort(move_order.begin(), move_order.begin() + move_count, [&](int a, int b) {
-        return scores[a] > scores[b];
-    });
+    moves.sort();
 
     // iterate over all pseudo-legal moves
     for (int i = 0; i < move_count; i++) {
-        if (moves[i].piece_index != -1) {
-
-            move_undo& undo = undo_stack[current_depth];
-            apply_move(state, moves[i], zobrist_hash, zobrist, undo, piece_on_square);
-            
-            // Ensure move is legal (not putting king in check)
-            if (pseudo_to_legal(state, !color, lookup_tables, get_occupancy(state.piece_bitboards))) {
-                
-                U64 new_occupancy_bitboard = get_occupancy(state.piece_bitboards);
-
-                perft(state, depth - 1, !color, lookup_tables,
-                    new_occupancy_bitboard, current_depth + 1, zobrist, zobrist_hash,
-                    moves_stack, undo_stack, node_count, piece_on_square);
-            }
+        // Ensure move is legal (not putting king in check), before it is made
+        if (!legal<Color>(state, moves[i], lookup_tables)) {
+            continue;
+        }
+
+        move_undo& undo = undo_stack[current_depth];
+        apply_move<Color>(state, moves[i], zobrist_hash, zobrist, undo, eval);
+
+        perft<!Color>(state, depth - 1, lookup_tables,
+            current_depth + 1, zobrist, zobrist_hash,
+            moves_stack, undo_stack, node_count);
+
+        // Undo the move
+        undo_move<Color>(state, moves[i], zobrist_hash, undo, eval);
+    }
+}
+
+// make/unmake check
+// after every legal move of a shallow search, the incremental hash and handcrafted score have to match the ones computed from scratch
+// and undoing the move has to give back those of the parent
+// returns false at the first move where they differ
+
+template <bool Color>
+bool check_make_unmake(game_state& state, int depth,
+    lookup_tables_wrap& lookup_tables, int current_depth,
+    zobrist_randoms& zobrist, U64& zobrist_hash,
+    std::array<move_list, 256>& moves_stack,
+    std::array<move_undo, 256>& undo_stack, handcrafted_eval& eval) {
+
+    if (depth == 0) {
+        return true;
+    }
+
+    update_state_info<Color>(state, lookup_tables);
+    int parent_score = handcrafted_evaluation(state, Color);
+
+    move_list& moves = moves_stack[current_depth];
+    int move_count = pseudo_legal_move_generator<Color>(moves, state, lookup_tables);
 
-            // Undo the move
-            undo_move(state, moves[i], zobrist_hash, zobrist, undo, piece_on_square);
+    for (int i = 0; i < move_count; i++) {
+        if (!legal<Color>(state, moves[i], lookup_tables)) {
+            continue;
+        }
+
+        U64 parent_hash = zobrist_hash;
+        move_undo& undo = undo_stack[current_depth];
+        apply_move<Color>(state, moves[i], zobrist_hash, zobrist, undo, eval);
 
+        std::string move_text = "the move from " + std::to_string(moves[i].from_position()) + " to " + std::to_string(moves[i].to_position())
+            + (moves[i].promotion() ? ", promotion to piece type " + std::to_string(moves[i].promotion_type()) : "");
+        if (zobrist_hash != compute_zobrist_hash(state, zobrist, !Color)) {
+            std::cout << "hash mismatch after " << move_text << std::endl;
+            return false;
+        }
+        int score = eval.evaluate(state, !Color, -INF, INF, zobrist_hash);
+        int expected_score = handcrafted_evaluation(state, !Color);
+        if (score != expected_score) {
+            std::cout << "handcrafted score " << score << " instead of " << expected_score << " after " << move_text << std::endl;
+            return false;
+        }
+        if (!check_make_unmake<!Color>(state, depth - 1, lookup_tables, current_depth + 1, zobrist, zobrist_hash, moves_stack, undo_stack, eval)) {
+            return false;
+        }
+
+        undo_move<Color>(state, moves[i], zobrist_hash, undo, eval);
+        if (zobrist_hash != parent_hash) {
+            std::cout << "hash not restored after undoing " << move_text << std::endl;
+            return false;
+        }
+        if (eval.evaluate(state, Color, -INF, INF, zobrist_hash) != parent_score) {
+            std::cout << "handcrafted score not restored after undoing " << move_text << std::endl;
+            return false;
         }
     }
+
+    return true;
 }
 
 //rename to something else for inclusion in other scripts
@@ -179,18 +229,9 @@ int main() {
     U64 b_queen = 576460752303423488ULL;
     U64 b_king = 1152921504606846976ULL;
 
-    U64 w_en_passant = 0ULL;
-    U64 b_en_passant = 0ULL;
-
-    bool w_long_castle = true;
-    bool w_short_castle = true;
-    bool b_long_castle = true;
-    bool b_short_castle = true;
-
     // initialize game state
     std::array<U64, 12> piece_bitboards = {w_pawn, w_knight, w_bishop, w_rook, w_queen, w_king, b_pawn, b_knight, b_bishop, b_rook, b_queen, b_king};
-    std::array<U64, 2> en_passant_bitboards = {w_en_passant, b_en_passant};
-    game_state initial_game_state(piece_bitboards, en_passant_bitboards, w_long_castle, w_short_castle, b_long_castle, b_short_castle);
+    game_state initial_game_state(piece_bitboards, NO_SQUARE, ALL_CASTLING);
 
     // create lookup tables
     lookup_tables_wrap lookup_tables;
@@ -201,7 +242,7 @@ int main() {
 
     // create move object array
     //untill depth 256
-    std::array<std::array<move, 256>, 256> moves_stack;
+    std::array<move_list, 256> moves_stack;
 
     // create move undo object array
     std::array<move_undo, 256> undo_stack;
@@ -212,61 +253,114 @@ int main() {
 
     // alternative game states
     std::array<U64, 12> piece_bitboards2 = {34628232960, 68719738880, 6144, 129, 2097152, 16, 12754334924144640, 37383395344384, 18015498021109760, 9295429630892703744, 4503599627370496, 1152921504606846976};
-    std::array<U64, 2> en_passant_bitboards2 = {w_en_passant, b_en_passant};
-    game_state game_state2(piece_bitboards2, en_passant_bitboards2, w_long_castle, w_short_castle, b_long_castle, b_short_castle);
+    game_state game_state2(piece_bitboards2, NO_SQUARE, ALL_CASTLING);
 
     std::cout << "Position 2" << std::endl;
     visualize_game_state(game_state2);
 
     // alternative game states
     std::array<U64, 12> piece_bitboards3 = {8589955072, 0, 0, 33554432, 0, 4294967296, 1134696536735744, 0, 0, 549755813888, 0, 2147483648};
-    std::array<U64, 2> en_passant_bitboards3 = {w_en_passant, b_en_passant};
-    game_state game_state3(piece_bitboards3, en_passant_bitboards3, false, false, false, false);
+    game_state game_state3(piece_bitboards3, NO_SQUARE, 0);
 
     std::cout << "Position 3" << std::endl;
     visualize_game_state(game_state3);
 
     // alternative game states
     std::array<U64, 12> piece_bitboards4 = {281483902241024, 140737490452480, 50331648, 33, 8, 64, 66991044457136640, 35188667056128, 72567767433216, 9295429630892703744, 65536, 1152921504606846976};
-    std::array<U64, 2> en_passant_bitboards4 = {w_en_passant, b_en_passant};
-    game_state game_state4(piece_bitboards4, en_passant_bitboards4, false, false, true, true);
+    game_state game_state4(piece_bitboards4, NO_SQUARE, BLACK_LONG_CASTLE | BLACK_SHORT_CASTLE);
 
     std::cout << "Position 4" << std::endl;
     visualize_game_state(game_state4);
 
     // alternative game states
     std::array<U64, 12> piece_bitboards5 = {2251799813736192, 4098, 67108868, 129, 8, 16, 63899217759830016, 144115188075864064, 292733975779082240, 9295429630892703744, 576460752303423488, 2305843009213693952};
-    std::array<U64, 2> en_passant_bitboards5 = {w_en_passant, b_en_passant};
-    game_state game_state5(piece_bitboards5, en_passant_bitboards5, true, true, false, false);
+    game_state game_state5(piece_bitboards5, NO_SQUARE, WHITE_LONG_CASTLE | WHITE_SHORT_CASTLE);
 
     std::cout << "Position 5" << std::endl;
     visualize_game_state(game_state5);
 
     // alternative game states
     std::array<U64, 12> piece_bitboards6 = {269084160, 2359296, 274945015808, 33, 4096, 64, 64749208967577600, 39582418599936, 18253611008, 2377900603251621888, 4503599627370496, 4611686018427387904};
-    std::array<U64, 2> en_passant_bitboards6 = {w_en_passant, b_en_passant};
-    game_state game_state6(piece_bitboards6, en_passant_bitboards6, false, false, false, false);
+    game_state game_state6(piece_bitboards6, NO_SQUARE, 0);
 
     std::cout << "Position 6" << std::endl;
     visualize_game_state(game_state6);
 
-    // perft
-    game_state perft_state = initial_game_state;
-    std::array<int, 64> piece_on_square;
-    U64 zobrist_hash = init_zobrist_hashing_mailbox(perft_state, zobrist, false, piece_on_square);
-    uint64_t node_count = 0;
+    // perft of every position, compared with the known results from https://www.chessprogramming.org/Perft_Results
+    struct perft_case {
+        game_state state;
+        int depth;
+        uint64_t expected;
+    };
+    std::array<perft_case, 6> perft_cases = {{
+        {initial_game_state, 5, 4865609},
+        {game_state2, 5, 193690690},
+        {game_state3, 6, 11030083},
+        {game_state4, 5, 15833292},
+        {game_state5, 5, 89941194},
+        {game_state6, 4, 3894594}
+    }};
+
+    // promotions of both colors, with and without capture, to every piece
+    // white: a7a8q, a7a8n, a7xb8, black: h2h1q, h2h1n, h2xg1
+    std::array<U64, 12> promotion_bitboards = {1ULL << 48, 1ULL << 6, 0, 0, 0, 1ULL << 4, 1ULL << 15, 0, 0, 1ULL << 57, 0, 1ULL << 60};
+    game_state promotion_state(promotion_bitboards, NO_SQUARE, 0);
+
+    // the incremental hash and handcrafted score of make/unmake, compared with the ones from scratch
+    // position 0 is the promotion position, the perft positions keep their numbers
+    std::vector<game_state> check_states = {promotion_state};
+    for (const perft_case& perft_case : perft_cases) {
+        check_states.push_back(perft_case.state);
+    }
+    std::vector<pawn_hash_entry> pawn_table(PAWN_TABLE_SIZE);
+    for (int i = 0; i < check_states.size(); i++) {
+        U64 zobrist_hash = init_zobrist_hashing(check_states[i], zobrist, false);
+        handcrafted_eval eval(check_states[i], zobrist, pawn_table);
+        if (!check_make_unmake<false>(check_states[i], 3, lookup_tables, 0, zobrist, zobrist_hash, moves_stack, undo_stack, eval)) {
+            std::cout << "Make/unmake check failed in position " << i << std::endl;
+            return 1;
+        }
+    }
+    std::cout << "Make/unmake check: incremental hash and handcrafted score match the ones from scratch" << std::endl;
+
+    // both slider attack backends, pext only on CPUs with BMI2
+    std::vector<bool> backends = {false};
+    if (__builtin_cpu_supports("bmi2")) {
+        backends.push_back(true);
+    }
+
+    for (bool pext_backend : backends) {
+        use_pext = pext_backend;
+        fill_slider_table(lookup_tables);
+        std::cout << (use_pext ? "pext" : "magic") << " backend" << std::endl;
 
-    auto start = std::chrono::high_resolution_clock::now();
+        uint64_t total_nodes = 0;
+        double total_ms = 0.0;
+        for (int i = 0; i < perft_cases.size(); i++) {
+            game_state perft_state = perft_cases[i].state;
+            U64 zobrist_hash = init_zobrist_hashing(perft_state, zobrist, false);
+            uint64_t node_count = 0;
 
-    perft(perft_state, 6, false, lookup_tables,
-          get_occupancy(perft_state.piece_bitboards), 0, zobrist, zobrist_hash, 
-          moves_stack, undo_stack, node_count, piece_on_square);
+            auto start = std::chrono::high_resolution_clock::now();
 
-    auto end = std::chrono::high_resolution_clock::now();
-    std::chrono::duration<double, std::milli> duration = end - start;
-    std::cout << "Time taken: " << duration.count() << " ms" << std::endl;
+            perft<false>(perft_state, perft_cases[i].depth, lookup_tables,
+                  0, zobrist, zobrist_hash, 
+                  moves_stack, undo_stack, node_count);
 
-    std::cout << "Total nodes: " << node_count << std::endl;
+            auto end = std::chrono::high_resolution_clock::now();
+            std::chrono::duration<double, std::milli> duration = end - start;
+            total_nodes += node_count;
+            total_ms += duration.count();
+
+            std::cout << "Position " << i + 1 << ", depth " << perft_cases[i].depth << ": " << node_count << " nodes"
+                      << (node_count == perft_cases[i].expected ? "" : " (expected " + std::to_string(perft_cases[i].expected) + ")")
+                      << ", " << duration.count() << " ms" << std::endl;
+        }
+
+        std::cout << "Total nodes: " << total_nodes << std::endl;
+        std::cout << "Time taken: " << total_ms << " ms" << std::endl;
+        std::cout << "Nodes/s: " << static_cast<long long>(total_nodes / (total_ms / 1000.0)) << std::endl;
+    }
 
     return 0;
-}
\ No newline at end of file
+}
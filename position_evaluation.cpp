@@ -0,0 +1,405 @@
+#include "position_evaluation.h"
+
+// handcrafted evaluation
+
+handcrafted_score compute_handcrafted_score(const game_state& state) {
+    // score of a position from scratch, the search only updates it
+
+    handcrafted_score score;
+    for (int piece_index = 0; piece_index < 12; piece_index++) {
+        U64 bitboard = state.piece_bitboard(piece_index);
+        while (bitboard) {
+            score.add(piece_index, __builtin_ctzll(bitboard));
+            bitboard &= bitboard - 1;
+        }
+    }
+    return score;
+}
+
+// pawn structure terms, (middlegame, endgame) in centipawns
+constexpr std::array<int, 8> passed_pawn_mg = {0, 5, 5, 10, 20, 35, 60, 0};
+constexpr std::array<int, 8> passed_pawn_eg = {0, 10, 15, 25, 45, 75, 120, 0};
+constexpr std::array<int, 8> free_passed_pawn_eg = {0, 0, 5, 10, 15, 25, 40, 0};
+constexpr int doubled_pawn_mg = -10, doubled_pawn_eg = -20;
+constexpr int isolated_pawn_mg = -10, isolated_pawn_eg = -15;
+constexpr int backward_pawn_mg = -8, backward_pawn_eg = -10;
+constexpr int shield_pawn_near = 12, shield_pawn_far = 6;
+
+
+// masks per color and square
+// front: the squares in front of a pawn on its own file
+// passed: the squares in front of a pawn on its own and the adjacent files
+// support: the squares on the adjacent files that are level with or behind a pawn
+struct pawn_masks {
+    std::array<U64, 8> adjacent_files{};
+    std::array<std::array<U64, 64>, 2> front{};
+    std::array<std::array<U64, 64>, 2> passed{};
+    std::array<std::array<U64, 64>, 2> support{};
+};
+
+constexpr pawn_masks generate_pawn_masks() {
+    pawn_masks masks{};
+    for (int file = 0; file < 8; file++) {
+        if (file > 0) masks.adjacent_files[file] |= FILE_A_MASK << (file - 1);
+        if (file < 7) masks.adjacent_files[file] |= FILE_A_MASK << (file + 1);
+    }
+    for (int square = 0; square < 64; square++) {
+        int file = square % 8;
+        int rank = square / 8;
+        for (int r = 0; r < 8; r++) {
+            for (int f = file - 1; f <= file + 1; f++) {
+                if (f < 0 || f > 7) {
+                    continue;
+                }
+                U64 bit = 1ULL << (r*8 + f);
+                if (r > rank) {
+                    masks.passed[0][square] |= bit;
+                    if (f == file) masks.front[0][square] |= bit;
+                }
+                if (r < rank) {
+                    masks.passed[1][square] |= bit;
+                    if (f == file) masks.front[1][square] |= bit;
+                }
+                if (f != file && r <= rank) masks.support[0][square] |= bit;
+                if (f != file && r >= rank) masks.support[1][square] |= bit;
+            }
+        }
+    }
+    return masks;
+}
+
+constexpr pawn_masks PAWN_MASKS = generate_pawn_masks();
+
+void evaluate_pawn_structure(const game_state& state, pawn_hash_entry& entry) {
+    // terms of both colors, from white's perspective
+
+    std::array<U64, 2> pawns = {state.piece_bitboard(0), state.piece_bitboard(6)};
+    std::array<U64, 2> pawn_attacks = {
+        ((pawns[0] << 7) & ~FILE_H_MASK) | ((pawns[0] << 9) & ~FILE_A_MASK),
+        ((pawns[1] >> 7) & ~FILE_A_MASK) | ((pawns[1] >> 9) & ~FILE_H_MASK)};
+
+    entry.mg = 0;
+    entry.eg = 0;
+    entry.passed_pawns = {0, 0};
+    entry.king_squares = {-1, -1};
+
+    for (int color = 0; color < 2; color++) {
+        int sign = color ? -1 : 1;
+        U64 own = pawns[color];
+        U64 enemy = pawns[1 - color];
+
+        U64 bitboard = own;
+        while (bitboard) {
+            int square = __builtin_ctzll(bitboard);
+            bitboard &= bitboard - 1;
+            int relative_rank = color ? 7 - square/8 : square/8;
+            int file = square % 8;
+
+            bool doubled = own & PAWN_MASKS.front[color][square];
+            bool isolated = !(own & PAWN_MASKS.adjacent_files[file]);
+            int stop_square = color ? square - 8 : square + 8;
+
+            if (doubled) {
+                entry.mg += sign*doubled_pawn_mg;
+                entry.eg += sign*doubled_pawn_eg;
+            }
+
+            if (isolated) {
+                entry.mg += sign*isolated_pawn_mg;
+                entry.eg += sign*isolated_pawn_eg;
+            }
+            else if (!(own & PAWN_MASKS.support[color][square]) && (pawn_attacks[1 - color] & (1ULL << stop_square))) {
+                // no pawn can defend it and it can not advance safely
+                entry.mg += sign*backward_pawn_mg;
+                entry.eg += sign*backward_pawn_eg;
+            }
+
+            // only the front pawn of a doubled pawn can be passed
+            if (!doubled && !(enemy & PAWN_MASKS.passed[color][square])) {
+                entry.passed_pawns[color] |= 1ULL << square;
+                entry.mg += sign*passed_pawn_mg[relative_rank];
+                entry.eg += sign*passed_pawn_eg[relative_rank];
+            }
+        }
+    }
+}
+
+int king_shield(U64 own_pawns, int king_square, int color) {
+    // own pawns on the three files around the king, one and two ranks in front of it
+
+    U64 king = 1ULL << king_square;
+    U64 front = color ? king >> 8 : king << 8;
+    U64 near = front | ((front << 1) & ~FILE_A_MASK) | ((front >> 1) & ~FILE_H_MASK);
+    U64 far = color ? near >> 8 : near << 8;
+    return shield_pawn_near*__builtin_popcountll(own_pawns & near) + shield_pawn_far*__builtin_popcountll(own_pawns & far);
+}
+
+void add_pawn_entry_terms(pawn_hash_entry& entry, const game_state& state, handcrafted_score& score) {
+    score.mg += entry.mg;
+    score.eg += entry.eg;
+
+    // the shield is a middlegame term, recomputed when a king has moved
+    for (int color = 0; color < 2; color++) {
+        int king_square = __builtin_ctzll(state.piece_bitboard(5 + 6*color));
+        if (entry.king_squares[color] != king_square) {
+            entry.king_squares[color] = king_square;
+            entry.shields[color] = king_shield(state.piece_bitboard(6*color), king_square, color);
+        }
+    }
+    score.mg += entry.shields[0] - entry.shields[1];
+
+    // passed pawns that can advance
+    U64 occupancy = state.occupancy;
+    U64 free_passed_white = entry.passed_pawns[0] & ~(occupancy >> 8);
+    U64 free_passed_black = entry.passed_pawns[1] & ~(occupancy << 8);
+    while (free_passed_white) {
+        score.eg += free_passed_pawn_eg[__builtin_ctzll(free_passed_white) / 8];
+        free_passed_white &= free_passed_white - 1;
+    }
+    while (free_passed_black) {
+        score.eg -= free_passed_pawn_eg[7 - __builtin_ctzll(free_passed_black) / 8];
+        free_passed_black &= free_passed_black - 1;
+    }
+}
+
+void add_pawn_terms(std::vector<pawn_hash_entry>& pawn_table, const game_state& state, handcrafted_score& score) {
+    // the table starts zeroed, which is the correct entry for the pawn key of no pawns
+
+    pawn_hash_entry& entry = pawn_table[score.pawn_key & (PAWN_TABLE_SIZE - 1)];
+    if (entry.key != score.pawn_key) {
+        evaluate_pawn_structure(state, entry);
+        entry.key = score.pawn_key;
+    }
+    add_pawn_entry_terms(entry, state, score);
+}
+
+// endgames
+
+int square_distance(int a, int b) {
+    return std::max(std::abs(a % 8 - b % 8), std::abs(a / 8 - b / 8));
+}
+
+// distance to the center, 0 on the four center squares and 6 in the corners
+constexpr std::array<int, 64> generate_center_distance() {
+    std::array<int, 64> distance{};
+    for (int square = 0; square < 64; square++) {
+        int file = square % 8;
+        int rank = square / 8;
+        distance[square] = (file < 4 ? 3 - file : file - 4) + (rank < 4 ? 3 - rank : rank - 4);
+    }
+    return distance;
+}
+
+constexpr std::array<int, 64> CENTER_DISTANCE = generate_center_distance();
+
+// mating needs the weak king on the edge and the strong king close to it
+int mop_up(int strong_king, int weak_king) {
+    return 20*CENTER_DISTANCE[weak_king] + 10*(7 - square_distance(strong_king, weak_king));
+}
+
+int side_material(const game_state& state, bool side) {
+    int material = 0;
+    for (int piece = 0; piece < 5; piece++) {
+        material += material_values[piece]*__builtin_popcountll(state.piece_bitboard(piece + 6*side));
+    }
+    return material;
+}
+
+bool light_square(int square) {
+    return (square % 8 + square / 8) % 2 == 1;
+}
+
+// evaluators return the score from the perspective of the strong side
+using endgame_evaluator = int (*)(const game_state& state, bool color, bool strong_side);
+
+// scalers return a scale factor for the normal evaluation
+using endgame_scaler = int (*)(const game_state& state, bool strong_side);
+
+int evaluate_kxk(const game_state& state, bool, bool strong_side) {
+    // lone king against enough material to mate
+
+    int strong_king = __builtin_ctzll(state.piece_bitboard(5 + 6*strong_side));
+    int weak_king = __builtin_ctzll(state.piece_bitboard(5 + 6*!strong_side));
+    return KNOWN_WIN + side_material(state, strong_side) + mop_up(strong_king, weak_king);
+}
+
+int evaluate_kbbk(const game_state& state, bool color, bool strong_side) {
+    // two bishops on the same color can not mate
+
+    U64 bishops = state.piece_bitboard(2 + 6*strong_side);
+    bool first = light_square(__builtin_ctzll(bishops));
+    bool second = light_square(63 - __builtin_clzll(bishops));
+    if (first == second) {
+        return 0;
+    }
+    return evaluate_kxk(state, color, strong_side);
+}
+
+int evaluate_kbnk(const game_state& state, bool, bool strong_side) {
+    // the mate is only possible in a corner of the color of the bishop
+
+    int strong_king = __builtin_ctzll(state.piece_bitboard(5 + 6*strong_side));
+    int weak_king = __builtin_ctzll(state.piece_bitboard(5 + 6*!strong_side));
+    int bishop = __builtin_ctzll(state.piece_bitboard(2 + 6*strong_side));
+
+    int corner_distance = light_square(bishop)
+        ? std::min(square_distance(weak_king, 7), square_distance(weak_king, 56))
+        : std::min(square_distance(weak_king, 0), square_distance(weak_king, 63));
+    return KNOWN_WIN + side_material(state, strong_side) + 10*(7 - square_distance(strong_king, weak_king)) + 40*(7 - corner_distance);
+}
+
+int evaluate_kpk(const game_state& state, bool color, bool strong_side) {
+    // rule of the square, key squares and the rook pawn draw
+    // squares are mirrored so the pawn always moves up the board
+
+    int flip = strong_side ? 56 : 0;
+    int pawn = __builtin_ctzll(state.piece_bitboard(6*strong_side)) ^ flip;
+    int strong_king = __builtin_ctzll(state.piece_bitboard(5 + 6*strong_side)) ^ flip;
+    int weak_king = __builtin_ctzll(state.piece_bitboard(5 + 6*!strong_side)) ^ flip;
+    bool strong_to_move = color == strong_side;
+
+    int file = pawn % 8;
+    int rank = pawn / 8;
+    int queening_square = 56 + file;
+    int win = KNOWN_WIN + material_values[0] + 20*rank;
+    int unclear = material_values[0]/4 + 5*rank;
+
+    // the weak king takes the pawn
+    if (!strong_to_move && square_distance(weak_king, pawn) == 1 && square_distance(strong_king, pawn) > 1) {
+        return 0;
+    }
+
+    // the weak king can not catch the pawn, if the strong king is not in the way
+    int pawn_distance = std::min(5, 7 - rank);
+    bool king_in_front = strong_king % 8 == file && strong_king > pawn;
+    if (!king_in_front && square_distance(weak_king, queening_square) - (strong_to_move ? 0 : 1) > pawn_distance) {
+        return win;
+    }
+
+    // a rook pawn is a draw when the weak king reaches the corner
+    if (file == 0 || file == 7) {
+        if (square_distance(weak_king, queening_square) <= 1 || (weak_king % 8 == file && weak_king > pawn)) {
+            return 0;
+        }
+        int key_file = file == 0 ? 1 : 6;
+        if (strong_king % 8 == key_file && strong_king / 8 >= 6) {
+            return win;
+        }
+        return unclear;
+    }
+
+    // the strong king on a key square wins
+    int lowest_key_rank = rank <= 3 ? rank + 2 : (rank <= 5 ? rank + 1 : rank);
+    int highest_key_rank = std::min(rank + 2, 7);
+    int king_file = strong_king % 8;
+    int king_rank = strong_king / 8;
+    if (std::abs(king_file - file) <= 1 && king_rank >= lowest_key_rank && king_rank <= highest_key_rank) {
+        return win;
+    }
+    return unclear;
+}
+
+int scale_draw(const game_state&, bool) {
+    return 0;
+}
+
+int scale_drawish(const game_state&, bool) {
+    return SCALE_NORMAL / 4;
+}
+
+int scale_kbpk(const game_state& state, bool strong_side) {
+    // a rook pawn with a bishop that does not control the queening square is a draw when the weak king reaches the corner
+
+    int pawn = __builtin_ctzll(state.piece_bitboard(6*strong_side));
+    int bishop = __builtin_ctzll(state.piece_bitboard(2 + 6*strong_side));
+    int weak_king = __builtin_ctzll(state.piece_bitboard(5 + 6*!strong_side));
+    int file = pawn % 8;
+    int queening_square = strong_side ? file : 56 + file;
+
+    if ((file == 0 || file == 7) && light_square(bishop) != light_square(queening_square) && square_distance(weak_king, queening_square) <= 1) {
+        return 0;
+    }
+    return SCALE_NORMAL;
+}
+
+int scale_kbpkb(const game_state& state, bool strong_side) {
+    // opposite colored bishops are very drawish
+
+    int strong_bishop = __builtin_ctzll(state.piece_bitboard(2 + 6*strong_side));
+    int weak_bishop = __builtin_ctzll(state.piece_bitboard(2 + 6*!strong_side));
+    if (light_square(strong_bishop) != light_square(weak_bishop)) {
+        return SCALE_NORMAL / 8;
+    }
+    return SCALE_NORMAL;
+}
+
+struct endgame_entry {
+    U64 key;
+    bool strong_side;
+    endgame_evaluator evaluate;
+    endgame_scaler scale;
+};
+
+std::vector<endgame_entry> generate_endgame_registry() {
+    // the uppercase pieces are the strong side, every endgame is also registered with the colors swapped
+
+    std::vector<endgame_entry> registry;
+    auto add = [&](const char* pieces, endgame_evaluator evaluate, endgame_scaler scale) {
+        U64 key = material_key(pieces);
+        registry.push_back({key, false, evaluate, scale});
+        if (flip_material_key(key) != key) {
+            registry.push_back({flip_material_key(key), true, evaluate, scale});
+        }
+    };
+
+    // known wins
+    for (const char* pieces : {"KQk", "KRk", "KQQk", "KQRk", "KQBk", "KQNk", "KRRk", "KRBk", "KRNk"}) {
+        add(pieces, evaluate_kxk, nullptr);
+    }
+    add("KBBk", evaluate_kbbk, nullptr);
+    add("KBNk", evaluate_kbnk, nullptr);
+    add("KPk", evaluate_kpk, nullptr);
+
+    // insufficient material and other draws
+    for (const char* pieces : {"Kk", "KNk", "KBk", "KNNk", "KNkn", "KBkb", "KBkn"}) {
+        add(pieces, nullptr, scale_draw);
+    }
+
+    // drawish
+    add("KRkb", nullptr, scale_drawish);
+    add("KRkn", nullptr, scale_drawish);
+    add("KBPk", nullptr, scale_kbpk);
+    add("KBPkb", nullptr, scale_kbpkb);
+
+    // sorted by key, a lookup is a binary search
+    std::sort(registry.begin(), registry.end(), [](const endgame_entry& a, const endgame_entry& b) { return a.key < b.key; });
+    return registry;
+}
+
+const std::vector<endgame_entry> endgame_registry = generate_endgame_registry();
+
+int apply_endgame_knowledge(const game_state& state, bool color, U64 material_key, int eval) {
+    auto entry = std::lower_bound(endgame_registry.begin(), endgame_registry.end(), material_key,
+        [](const endgame_entry& e, U64 key) { return e.key < key; });
+    if (entry == endgame_registry.end() || entry->key != material_key) {
+        return eval;
+    }
+
+    if (entry->evaluate) {
+        int score = entry->evaluate(state, color, entry->strong_side);
+        return entry->strong_side ? -score : score;
+    }
+    return eval * entry->scale(state, entry->strong_side) / SCALE_NORMAL;
+}
+
+int handcrafted_evaluation(const game_state& state, bool color) {
+    handcrafted_score score = compute_handcrafted_score(state);
+    pawn_hash_entry pawns;
+    evaluate_pawn_structure(state, pawns);
+    add_pawn_entry_terms(pawns, state, score);
+    int eval = score.tapered();
+    if (score.piece_count <= MAX_ENDGAME_PIECES) {
+        eval = apply_endgame_knowledge(state, color, score.material_key, eval);
+    }
+    return color ? -eval : eval;
+}
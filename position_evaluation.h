@@ -0,0 +1,344 @@
+#include "move_generation.h"
+#include "evaluation.h"
+
+// evaluation of a game state
+// the handcrafted evaluation, and the evaluation policies that make/unmake and the search are instantiated with
+// the network itself is in evaluation.h
+
+// handcrafted evaluation
+// tapered piece-square evaluation, based on the simplified evaluation function on chessprogramming.org
+// every piece on a square has a middlegame and an endgame value (material + piece-square table)
+// the score is interpolated between the two by the game phase, MAX_PHASE with all knights, bishops, rooks and queens on the board
+// tables are indexed from white's perspective (a1 = 0), black uses the square 63 - square
+
+constexpr int MAX_PHASE = 24;
+constexpr std::array<int, 6> phase_values = {0, 1, 1, 2, 4, 0};
+constexpr std::array<int, 6> material_values = {100, 320, 330, 500, 900, 0};
+
+constexpr std::array<std::array<int, 64>, 6> mg_square_tables = {{
+    // pawn
+    {0, 0, 0, 0, 0, 0, 0, 0, 5, 10, 10, -20, -20, 10, 10, 5, 5, -5, -10, 0, 0, -10, -5, 5, 0, 0, 0, 20, 20, 0, 0, 0, 5, 5, 10, 25, 25, 10, 5, 5, 10, 10, 20, 30, 30, 20, 10, 10, 50, 50, 50, 50, 50, 50, 50, 50, 0, 0, 0, 0, 0, 0, 0, 0},
+    // knight
+    {-50, -40, -30, -30, -30, -30, -40, -50, -40, -20, 0, 5, 5, 0, -20, -40, -30, 5, 10, 15, 15, 10, 5, -30, -30, 0, 15, 20, 20, 15, 0, -30, -30, 5, 15, 20, 20, 15, 5, -30, -30, 0, 10, 15, 15, 10, 0, -30, -40, -20, 0, 0, 0, 0, -20, -40, -50, -40, -30, -30, -30, -30, -40, -50},
+    // bishop
+    {-20, -10, -10, -10, -10, -10, -10, -20, -10, 5, 0, 0, 0, 0, 5, -10, -10, 10, 10, 10, 10, 10, 10, -10, -10, 0, 10, 10, 10, 10, 0, -10, -10, 5, 5, 10, 10, 5, 5, -10, -10, 0, 5, 10, 10, 5, 0, -10, -10, 0, 0, 0, 0, 0, 0, -10, -20, -10, -10, -10, -10, -10, -10, -20},
+    // rook
+    {0, 0, 0, 5, 5, 0, 0, 0, -5, 0, 0, 0, 0, 0, 0, -5, -5, 0, 0, 0, 0, 0, 0, -5, -5, 0, 0, 0, 0, 0, 0, -5, -5, 0, 0, 0, 0, 0, 0, -5, -5, 0, 0, 0, 0, 0, 0, -5, 5, 10, 10, 10, 10, 10, 10, 5, 0, 0, 0, 0, 0, 0, 0, 0},
+    // queen
+    {-20, -10, -10, -5, -5, -10, -10, -20, -10, 0, 5, 0, 0, 0, 0, -10, -10, 5, 5, 5, 5, 5, 0, -10, 0, 0, 5, 5, 5, 5, 0, -5, -5, 0, 5, 5, 5, 5, 0, -5, -10, 0, 5, 5, 5, 5, 0, -5, -10, 0, 0, 0, 0, 0, 0, -10, -20, -10, -10, -5, -5, -10, -10, -20},
+    // king
+    {20, 30, 10, 0, 0, 10, 30, 20, 20, 20, 0, 0, 0, 0, 20, 20, -10, -20, -20, -20, -20, -20, -20, -10, -20, -30, -30, -40, -40, -30, -30, -20, -30, -40, -40, -50, -50, -40, -40, -30, -30, -40, -40, -50, -50, -40, -40, -30, -30, -40, -40, -50, -50, -40, -40, -30, -30, -40, -40, -50, -50, -40, -40, -30}
+}};
+
+// only the king changes its table in the endgame, it has to come forward
+constexpr std::array<std::array<int, 64>, 6> eg_square_tables = {
+    mg_square_tables[0], mg_square_tables[1], mg_square_tables[2], mg_square_tables[3], mg_square_tables[4],
+    {-50, -30, -30, -30, -30, -30, -30, -50, -30, -30, 0, 0, 0, 0, -30, -30, -30, -10, 20, 30, 30, 20, -10, -30, -30, -10, 30, 40, 40, 30, -10, -30, -30, -10, 30, 40, 40, 30, -10, -30, -30, -10, 20, 30, 30, 20, -10, -30, -30, -20, -10, 0, 0, -10, -20, -30, -50, -40, -30, -20, -20, -30, -40, -50}
+};
+
+// value of every piece index on every square, positive for white and negative for black
+constexpr std::array<std::array<int, 64>, 12> signed_square_values(const std::array<std::array<int, 64>, 6>& square_tables) {
+    std::array<std::array<int, 64>, 12> values{};
+    for (int piece = 0; piece < 6; piece++) {
+        for (int square = 0; square < 64; square++) {
+            values[piece][square] = material_values[piece] + square_tables[piece][square];
+            values[piece + 6][square] = -(material_values[piece] + square_tables[piece][63 - square]);
+        }
+    }
+    return values;
+}
+
+constexpr std::array<std::array<int, 64>, 12> mg_values = signed_square_values(mg_square_tables);
+constexpr std::array<std::array<int, 64>, 12> eg_values = signed_square_values(eg_square_tables);
+
+// material signature
+// the number of every piece type, except the kings, packed in 4 bits each
+// adding or removing a piece adds or subtracts its unit, so the key is updated with the other sums
+// the key is written as a string of pieces, uppercase for white and lowercase for black: "KBNk"
+constexpr std::array<U64, 12> material_key_units = {
+    1ULL << 0, 1ULL << 4, 1ULL << 8, 1ULL << 12, 1ULL << 16, 0,
+    1ULL << 20, 1ULL << 24, 1ULL << 28, 1ULL << 32, 1ULL << 36, 0};
+
+constexpr U64 material_key(const char* pieces) {
+    constexpr char piece_letters[] = "PNBRQKpnbrqk";
+    U64 key = 0;
+    for (; *pieces; pieces++) {
+        for (int piece_index = 0; piece_index < 12; piece_index++) {
+            if (piece_letters[piece_index] == *pieces) {
+                key += material_key_units[piece_index];
+            }
+        }
+    }
+    return key;
+}
+
+// the same material with the colors swapped
+constexpr U64 flip_material_key(U64 key) {
+    return (key >> 20) | ((key & 0xFFFFF) << 20);
+}
+
+// middlegame and endgame sums from white's perspective, the game phase, the number of pieces and the pawn and material keys
+struct handcrafted_score {
+    int mg = 0;
+    int eg = 0;
+    int phase = 0;
+    int piece_count = 0;
+    U64 pawn_key = 0;
+    U64 material_key = 0;
+
+    void add(int piece_index, int square) {
+        mg += mg_values[piece_index][square];
+        eg += eg_values[piece_index][square];
+        phase += phase_values[piece_index % 6];
+        piece_count++;
+        material_key += material_key_units[piece_index];
+    }
+
+    void remove(int piece_index, int square) {
+        mg -= mg_values[piece_index][square];
+        eg -= eg_values[piece_index][square];
+        phase -= phase_values[piece_index % 6];
+        piece_count--;
+        material_key -= material_key_units[piece_index];
+    }
+
+    // interpolation between middlegame and endgame, more material than at the start counts as the middlegame
+    int tapered() const {
+        int clamped_phase = phase < MAX_PHASE ? phase : MAX_PHASE;
+        return (mg*clamped_phase + eg*(MAX_PHASE - clamped_phase)) / MAX_PHASE;
+    }
+};
+
+handcrafted_score compute_handcrafted_score(const game_state& state);
+
+// pawn structure
+// passed, doubled, isolated and backward pawns only depend on the pawns, so they are cached by pawn key
+// the king shield also depends on the king square, it is cached per color for the last king square it was computed for
+// one table per search thread
+
+constexpr size_t PAWN_TABLE_SIZE = 1 << 16;
+
+struct pawn_hash_entry {
+    U64 key = 0;
+    int mg = 0;
+    int eg = 0;
+    std::array<U64, 2> passed_pawns{};
+    std::array<int8_t, 2> king_squares = {-1, -1};
+    std::array<int16_t, 2> shields{};
+};
+
+// pawn terms of a pawn structure from scratch
+void evaluate_pawn_structure(const game_state& state, pawn_hash_entry& entry);
+
+// add the pawn structure, king shield and free passed pawn terms of an entry to a score
+void add_pawn_entry_terms(pawn_hash_entry& entry, const game_state& state, handcrafted_score& score);
+
+// same, with the entry looked up in the pawn hash table by the pawn key of the score
+void add_pawn_terms(std::vector<pawn_hash_entry>& pawn_table, const game_state& state, handcrafted_score& score);
+
+// endgames
+// positions with few pieces are looked up by material key in a registry of specialized functions, sorted by key
+// an evaluator replaces the score (known wins and draws), a scaler scales it towards a draw (0 is a dead draw, SCALE_NORMAL changes nothing)
+
+constexpr int MAX_ENDGAME_PIECES = 5;
+constexpr int KNOWN_WIN = 10000;
+constexpr int SCALE_NORMAL = 64;
+
+// the score or scale of a position for the evaluation of the endgame, eval and the result are from white's perspective
+int apply_endgame_knowledge(const game_state& state, bool color, U64 material_key, int eval);
+
+// handcrafted evaluation from scratch, from the perspective of the side to move
+// handcrafted_eval keeps the same score up to date move by move, perft compares the two
+int handcrafted_evaluation(const game_state& state, bool color);
+
+// counters of an evaluation policy, for the bench command
+struct eval_stats {
+    U64 moves = 0;
+    U64 evaluations = 0;
+    U64 lazy_evaluations = 0;
+    U64 cache_probes = 0;
+    U64 cache_hits = 0;
+
+    void add(const eval_stats& other) {
+        moves += other.moves;
+        evaluations += other.evaluations;
+        lazy_evaluations += other.lazy_evaluations;
+        cache_probes += other.cache_probes;
+        cache_hits += other.cache_hits;
+    }
+};
+
+// evaluation cache
+// direct mapped, zobrist hash -> score from the perspective of the side to move
+// consulted before the network runs, one table per search thread
+constexpr size_t EVAL_CACHE_SIZE = 1 << 16;
+
+struct eval_cache_entry {
+    U64 hash = 0;
+    int score = 0;
+};
+
+// handcrafted evaluation, the score is updated with every changed piece
+// one score per ply, so undoing a move is a decrement
+struct handcrafted_eval {
+    std::array<handcrafted_score, ACCUMULATOR_STACK_SIZE> scores;
+    int current = 0;
+    const zobrist_randoms& zobrist;
+    std::vector<pawn_hash_entry>& pawn_table;
+
+    handcrafted_eval(const game_state& state, const zobrist_randoms& zobrist_keys, std::vector<pawn_hash_entry>& pawn_hash_table)
+        : zobrist(zobrist_keys), pawn_table(pawn_hash_table) {
+        scores[0] = compute_handcrafted_score(state);
+        for (int piece_index : {0, 6}) {
+            U64 pawns = state.piece_bitboard(piece_index);
+            while (pawns) {
+                scores[0].pawn_key ^= zobrist.zobrist_piece_table[__builtin_ctzll(pawns)*NUM_PIECES + piece_index];
+                pawns &= pawns - 1;
+            }
+        }
+    }
+
+    eval_stats stats;
+
+    void push() {
+        scores[current + 1] = scores[current];
+        current++;
+        stats.moves++;
+    }
+
+    void pop() {
+        current--;
+    }
+
+    void add_dirty_piece(int piece_index, int from, int to) {
+        handcrafted_score& score = scores[current];
+        if (from >= 0) {
+            score.remove(piece_index, from);
+        }
+        if (to >= 0) {
+            score.add(piece_index, to);
+        }
+
+        // the pawn key uses the same randoms as the position key
+        if (piece_index % 6 == 0) {
+            if (from >= 0) {
+                score.pawn_key ^= zobrist.zobrist_piece_table[from*NUM_PIECES + piece_index];
+            }
+            if (to >= 0) {
+                score.pawn_key ^= zobrist.zobrist_piece_table[to*NUM_PIECES + piece_index];
+            }
+        }
+    }
+
+    // the pawn hash entry of the new pawn structure
+    void prefetch(const game_state& state, U64 hash) const {
+        __builtin_prefetch(&pawn_table[scores[current].pawn_key & (PAWN_TABLE_SIZE - 1)]);
+    }
+
+    // from the perspective of the side to move, the window and the hash are not used
+    int evaluate(game_state& state, bool color, int alpha, int beta, U64 hash) {
+        stats.evaluations++;
+        handcrafted_score score = scores[current];
+        add_pawn_terms(pawn_table, state, score);
+        int eval = score.tapered();
+        if (score.piece_count <= MAX_ENDGAME_PIECES) {
+            eval = apply_endgame_knowledge(state, color, score.material_key, eval);
+        }
+        return color ? -eval : eval;
+    }
+};
+
+// NNUE evaluation, the changed pieces go to the lazy accumulator stack
+// the material and piece-square score is kept next to it as a cheap first pass
+// when it is more than lazy_margin outside the alpha-beta window, the position is clearly decided and the network is not run
+// a margin of LAZY_EVAL_OFF always runs the network
+// the accumulator is then never computed for that position
+
+constexpr int DEFAULT_LAZY_MARGIN = 1000;
+constexpr int LAZY_EVAL_OFF = -1;
+
+struct nnue_eval {
+    accumulator_stack& accumulators;
+    const quantized_network& network;
+    std::vector<eval_cache_entry>* cache;
+    int lazy_margin;
+    std::array<handcrafted_score, ACCUMULATOR_STACK_SIZE> material_scores;
+    int current = 0;
+    eval_stats stats;
+
+    // without a cache, every evaluation that is not lazy runs the network
+    nnue_eval(const game_state& state, accumulator_stack& stack, const quantized_network& nnue, std::vector<eval_cache_entry>* eval_cache, int margin = DEFAULT_LAZY_MARGIN)
+        : accumulators(stack), network(nnue), cache(eval_cache), lazy_margin(margin) {
+        material_scores[0] = compute_handcrafted_score(state);
+    }
+
+    void push() {
+        accumulators.push();
+        material_scores[current + 1] = material_scores[current];
+        current++;
+        stats.moves++;
+    }
+
+    void pop() {
+        accumulators.pop();
+        current--;
+    }
+
+    void add_dirty_piece(int piece_index, int from, int to) {
+        accumulators.add_dirty_piece(piece_index, from, to);
+        if (from >= 0) {
+            material_scores[current].remove(piece_index, from);
+        }
+        if (to >= 0) {
+            material_scores[current].add(piece_index, to);
+        }
+    }
+
+    // the eval cache entry
+    void prefetch(const game_state& state, U64 hash) const {
+        if (cache) {
+            __builtin_prefetch(&(*cache)[hash & (EVAL_CACHE_SIZE - 1)]);
+        }
+    }
+
+    // from the perspective of the side to move
+    // known endgames get the evaluators and scalers of the handcrafted evaluation, on top of the network score
+    int evaluate(game_state& state, bool color, int alpha, int beta, U64 hash) {
+        stats.evaluations++;
+        const handcrafted_score& material_score = material_scores[current];
+        int eval = network_score(state, color, alpha, beta, hash);
+        if (material_score.piece_count <= MAX_ENDGAME_PIECES) {
+            eval = color ? -eval : eval;
+            eval = apply_endgame_knowledge(state, color, material_score.material_key, eval);
+            eval = color ? -eval : eval;
+        }
+        return eval;
+    }
+
+    // the lazy material score, the cached network score or the network score, from the perspective of the side to move
+    int network_score(game_state& state, bool color, int alpha, int beta, U64 hash) {
+        int material = material_scores[current].tapered();
+        if (color) {
+            material = -material;
+        }
+        if (lazy_margin != LAZY_EVAL_OFF && (material - lazy_margin >= beta || material + lazy_margin <= alpha)) {
+            stats.lazy_evaluations++;
+            return material;
+        }
+
+        if (!cache) {
+            return nnue_evaluation(accumulators, network, state.piece_bitboards(), color);
+        }
+
+        stats.cache_probes++;
+        eval_cache_entry& cached = (*cache)[hash & (EVAL_CACHE_SIZE - 1)];
+        if (cached.hash == hash) {
+            stats.cache_hits++;
+            return cached.score;
+        }
+        int score = nnue_evaluation(accumulators, network, state.piece_bitboards(), color);
+        cached.hash = hash;
+        cached.score = score;
+        return score;
+    }
+};
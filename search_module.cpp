@@ -22,7 +22,7 @@ void visualize_game_state(const game_state& state) {
 
     // Fill the board with pieces
     for (int i = 0; i < 12; ++i) {
-        U64 bitboard = state.piece_bitboards[i];
+        U64 bitboard = state.piece_bitboard(i);
         for (int square = 0; square < 64; ++square) {
             if (bitboard & (1ULL << square)) {
                 int row = 7 - (square / 8);
@@ -32,16 +32,11 @@ void visualize_game_state(const game_state& state) {
         }
     }
 
-    // Mark en passant squares
-    for (int i = 0; i < 2; ++i) {
-        U64 ep_board = state.en_passant_bitboards[i];
-        for (int square = 0; square < 64; ++square) {
-            if (ep_board & (1ULL << square)) {
-                int row = 7 - (square / 8);
-                int col = square % 8;
-                board[row][col] = '*';  // En passant target square
-            }
-        }
+    // Mark en passant square
+    if (state.en_passant_square != NO_SQUARE) {
+        int row = 7 - (state.en_passant_square / 8);
+        int col = state.en_passant_square % 8;
+        board[row][col] = '*';  // En passant target square
     }
 
     // Print the board
@@ -58,83 +53,28 @@ void visualize_game_state(const game_state& state) {
 
     // Print castling rights
     std::cout << "Castling rights: "
-              << (state.w_long_castle ? "Q" : "-")
-              << (state.w_short_castle ? "K" : "-")
-              << (state.b_long_castle ? "q" : "-")
-              << (state.b_short_castle ? "k" : "-") << "\n";
-}
-
-// evaluation
-int evaluation(game_state &state) {
-    // basic evaluation with piece square tables, based on the simplified evaluation function on chessprogramming.org
-
-    // piece square tables
-    std::array<int, 64> pawn_square_table = {0, 0, 0, 0, 0, 0, 0, 0, 5, 10, 10, -20, -20, 10, 10, 5, 5, -5, -10, 0, 0, -10, -5, 5, 0, 0, 0, 20, 20, 0, 0, 0, 5, 5, 10, 25, 25, 10, 5, 5, 10, 10, 20, 30, 30, 20, 10, 10, 50, 50, 50, 50, 50, 50, 50, 50, 0, 0, 0, 0, 0, 0, 0, 0};
-    std::array<int, 64> knight_square_table = {-50, -40, -30, -30, -30, -30, -40, -50, -40, -20, 0, 5, 5, 0, -20, -40, -30, 5, 10, 15, 15, 10, 5, -30, -30, 0, 15, 20, 20, 15, 0, -30, -30, 5, 15, 20, 20, 15, 5, -30, -30, 0, 10, 15, 15, 10, 0, -30, -40, -20, 0, 0, 0, 0, -20, -40, -50, -40, -30, -30, -30, -30, -40, -50};
-    std::array<int, 64> bishop_square_table = {-20, -10, -10, -10, -10, -10, -10, -20, -10, 5, 0, 0, 0, 0, 5, -10, -10, 10, 10, 10, 10, 10, 10, -10, -10, 0, 10, 10, 10, 10, 0, -10, -10, 5, 5, 10, 10, 5, 5, -10, -10, 0, 5, 10, 10, 5, 0, -10, -10, 0, 0, 0, 0, 0, 0, -10, -20, -10, -10, -10, -10, -10, -10, -20};
-    std::array<int, 64> rook_square_table = {0, 0, 0, 5, 5, 0, 0, 0, -5, 0, 0, 0, 0, 0, 0, -5, -5, 0, 0, 0, 0, 0, 0, -5, -5, 0, 0, 0, 0, 0, 0, -5, -5, 0, 0, 0, 0, 0, 0, -5, -5, 0, 0, 0, 0, 0, 0, -5, 5, 10, 10, 10, 10, 10, 10, 5, 0, 0, 0, 0, 0, 0, 0, 0};
-    std::array<int, 64> queen_square_table = {-20, -10, -10, -5, -5, -10, -10, -20, -10, 0, 5, 0, 0, 0, 0, -10, -10, 5, 5, 5, 5, 5, 0, -10, 0, 0, 5, 5, 5, 5, 0, -5, -5, 0, 5, 5, 5, 5, 0, -5, -10, 0, 5, 5, 5, 5, 0, -5, -10, 0, 0, 0, 0, 0, 0, -10, -20, -10, -10, -5, -5, -10, -10, -20};
-    std::array<int, 64> king_square_table = {20, 30, 10, 0, 0, 10, 30, 20, 20, 20, 0, 0, 0, 0, 20, 20, -10, -20, -20, -20, -20, -20, -20, -10, -20, -30, -30, -40, -40, -30, -30, -20, -30, -40, -40, -50, -50, -40, -40, -30, -30, -40, -40, -50, -50, -40, -40, -30, -30, -40, -40, -50, -50, -40, -40, -30, -30, -40, -40, -50, -50, -40, -40, -30};
-    
-    std::array<std::array<int, 64>, 6> piece_square_tables = {pawn_square_table, knight_square_table, bishop_square_table, rook_square_table, queen_square_table, king_square_table};
-
-    std::array<int, 64> endgame_king_square_table = {-50, -30, -30, -30, -30, -30, -30, -50, -30, -30, 0, 0, 0, 0, -30, -30, -30, -10, 20, 30, 30, 20, -10, -30, -30, -10, 30, 40, 40, 30, -10, -30, -30, -10, 30, 40, 40, 30, -10, -30, -30, -10, 20, 30, 30, 20, -10, -30, -30, -20, -10, 0, 0, -10, -20, -30, -50, -40, -30, -20, -20, -30, -40, -50};
-    
-    int white_score = 0;
-    int black_score = 0;
-
-    // iterate over all pieces, except king
-    for (int piece_index = 0; piece_index < 5; ++piece_index) {
-        U64 bb_white = state.piece_bitboards[piece_index];
-        while (bb_white) {
-            int square = __builtin_ctzll(bb_white);
-            
-            white_score += piece_values[piece_index];
-            white_score += piece_square_tables[piece_index][square];
-            
-            bb_white &= bb_white - 1;
-        }
-
-        U64 bb_black = state.piece_bitboards[piece_index + 6];
-        while (bb_black) {
-            int square = __builtin_ctzll(bb_black);
-            black_score += piece_values[piece_index];
-            black_score += piece_square_tables[piece_index][63 - square];
-            bb_black &= bb_black - 1;
-        }
-    }
-
-    // king evaluation
-    U64 bb_white_king = state.piece_bitboards[5];
-    U64 bb_black_king = state.piece_bitboards[11];
-    int white_king_square = __builtin_ctzll(bb_white_king);
-    int black_king_square = __builtin_ctzll(bb_black_king);
-
-    if (white_score + black_score < 1400) {
-        // endgame evaluation
-        white_score += endgame_king_square_table[white_king_square];
-        black_score += endgame_king_square_table[63 - black_king_square];
-    }
-    else {
-        // middle game evaluation
-        white_score += piece_square_tables[5][white_king_square];
-        black_score += piece_square_tables[5][63 - black_king_square];
-    }
-
-    white_score += piece_values[5];
-    black_score += piece_values[5];
-
-    int score = white_score - black_score;
-    return score;
+              << (state.castling_rights & WHITE_LONG_CASTLE ? "Q" : "-")
+              << (state.castling_rights & WHITE_SHORT_CASTLE ? "K" : "-")
+              << (state.castling_rights & BLACK_LONG_CASTLE ? "q" : "-")
+              << (state.castling_rights & BLACK_SHORT_CASTLE ? "k" : "-") << "\n";
 }
 
 // search algorithm
 
 // move ordering
-void order_moves(std::array<int, 256>& move_order, 
-    std::array<int, 256>& scores, std::array<move, 256>& moves, int& move_count,
-    std::array<int, 64>& piece_on_square, int& num_non_quiet,
-    move& best_move, int& current_depth,
+// Color is the side to move
+// quiet checks are only looked for at nodes with at least this remaining depth
+// the nodes just above the leaves are the most numerous, and testing every quiet move there costs more than the ordering saves
+constexpr int QUIET_CHECK_MIN_DEPTH = 2;
+
+// captures are scored victim*10 - attacker, the lowest capture that does not lose material is a pawn taking a pawn
+// quiet checks come right below it, the history scores of the other quiet moves stay below the quiet checks
+constexpr int QUIET_CHECK_SCORE = pawn_value*10 - pawn_value - 1;
+
+template <bool Color>
+void order_moves(move_list& moves, int& move_count,
+    const game_state& state, lookup_tables_wrap& lookup_tables,
+    move& best_move, int& current_depth, int depth,
     std::array<std::array<move, 2>, MAX_DEPTH>& killer_moves,
     std::array<std::array<int, 64>, 64>& history_moves) {
 
@@ -142,74 +82,66 @@ void order_moves(std::array<int, 256>& move_order,
     for (int i = 0; i < move_count; i++) {
 
         int score = 0;
-        int victim_index = piece_on_square[moves[i].to_position];
+        int from_position = moves[i].from_position();
+        int to_position = moves[i].to_position();
+        int victim_index = state.piece_on_square[to_position];
 
         // check for best move
-        if (moves[i].piece_index == best_move.piece_index &&
-            moves[i].from_position == best_move.from_position &&
-            moves[i].to_position == best_move.to_position) {
+        if (moves[i] == best_move) {
             //std::cout << "best move" << std::endl;
             score += 10000;
-            num_non_quiet++;
         }
         // check for killer move
-        else if (killer_moves[current_depth][0].from_position == moves[i].from_position &&
-            killer_moves[current_depth][0].to_position == moves[i].to_position) {
+        else if (killer_moves[current_depth][0].from_position() == from_position &&
+            killer_moves[current_depth][0].to_position() == to_position) {
             score += 9500;
-            num_non_quiet++;
         }
-        else if (killer_moves[current_depth][1].from_position == moves[i].from_position &&
-            killer_moves[current_depth][1].to_position == moves[i].to_position) {
+        else if (killer_moves[current_depth][1].from_position() == from_position &&
+            killer_moves[current_depth][1].to_position() == to_position) {
             score += 9500;
-            num_non_quiet++;
         }
         // check for capture
-        else if (victim_index > 0) {
+        else if (victim_index != NO_PIECE) {
             int victim_value = piece_values[victim_index%6];
-            int attacker_value = piece_values[moves[i].piece_index%6];
+            int attacker_value = piece_values[state.piece_on_square[from_position]%6];
             score = victim_value*10 - attacker_value;
-            num_non_quiet++;
         }
         
+        // quiet checks, after the captures that do not lose material, away from the frontier
+        else if (depth >= QUIET_CHECK_MIN_DEPTH && gives_check<Color>(state, moves[i], lookup_tables)) {
+            score = QUIET_CHECK_SCORE;
+        }
         // quiet moves
         else {
-            score = history_moves[moves[i].from_position][moves[i].to_position];
+            score = history_moves[from_position][to_position];
         }
 
-        scores[i] = score;
-        move_order[i] = i; // store the index
+        moves.entries[i].score = score;
     }
 
     // sort moves based on scores
-    std::sort(move_order.begin(), move_order.begin() + move_count, [&](int a, int b) {
-        return scores[a] > scores[b];
-    });
+    moves.sort();
 }
 
 // fast negamax search with alpha-beta pruning.
 // 'depth' is the remaining search depth, and alpha-beta parameters prune branches.
-int negamax(game_state &state, int depth, int alpha, int beta, bool color, 
-    lookup_tables_wrap& lookup_tables,
-    const U64& occupancy_bitboard, int current_depth,
+// Color is the side to move, the children are searched with the other instantiation
+template <bool Color, typename Eval>
+int negamax(game_state &state, int depth, int alpha, int beta, 
+    lookup_tables_wrap& lookup_tables, int current_depth,
     zobrist_randoms& zobrist, U64& zobrist_hash,
-    std::array<std::array<move, 256>, 256>& moves_stack, 
+    std::array<move_list, MAX_DEPTH>& moves_stack, 
     std::array<move_undo, 256>& undo_stack,
     std::vector<transposition_table_entry>& transposition_table,
-    std::array<int, 64>& piece_on_square,
     std::array<move, MAX_DEPTH>& pv, int& pv_length,
     std::array<std::array<move, 2>, MAX_DEPTH>& killer_moves,
     std::array<std::array<int, 64>, 64>& history_moves, 
-    NNUE_accumulator& accumulator,
-    const linear_layer<INPUT_SIZE, HIDDEN1_SIZE>& layer1,
-    const linear_layer<HIDDEN1_SIZE*2, HIDDEN2_SIZE>& layer2,
-    const linear_layer<HIDDEN2_SIZE, HIDDEN3_SIZE>& layer3,
-    const linear_layer<HIDDEN3_SIZE, OUTPUT_SIZE>& layer4) {
+    Eval& eval_policy) {
 
     if (depth == 0) {
         pv_length = 0;
 
-        int eval = nnue_evaluation(accumulator, layer2, layer3, layer4, color);//evaluation(state);
-        //return color ? -eval : eval;
+        int eval = eval_policy.evaluate(state, Color, alpha, beta, zobrist_hash);
 
         //std::cout << "Leaf evaluation at depth " << current_depth << ": " << eval << std::endl;
 
@@ -243,12 +175,26 @@ int negamax(game_state &state, int depth, int alpha, int beta, bool color,
         best_move = entry.best_move;
     }
 
+    // the checks and pins of this position, for the move generation, the legality of the moves and the pruning decisions
+    // the leaves return before this, apply_move keeps the info of the parent in the undo stack
+    update_state_info<Color>(state, lookup_tables);
+
     // null move pruning (needs to be before move generation)
-    bool not_in_check = pseudo_to_legal(state, !color, lookup_tables, occupancy_bitboard);
+    bool not_in_check = !state.info.checkers;
     if (depth >= 3 && not_in_check) {
         // null move
+        // the en passant square belongs to the side to move, the other side can not capture on it
+        // the child computes the checks and pins for the other side, they are restored afterwards
+        int en_passant_square = state.en_passant_square;
+        state_info info = state.info;
         U64 null_zobrist_hash = zobrist_hash ^ zobrist.zobrist_black_to_move;
-        int score = -negamax(state, depth - 3, -beta, -beta + 1, !color, lookup_tables, occupancy_bitboard, current_depth + 1, zobrist, null_zobrist_hash, moves_stack, undo_stack, transposition_table, piece_on_square, child_pv, child_pv_length, killer_moves, history_moves, accumulator, layer1, layer2, layer3, layer4);
+        if (en_passant_square != NO_SQUARE) {
+            null_zobrist_hash ^= zobrist.zobrist_en_passant[en_passant_square % 8];
+            state.en_passant_square = NO_SQUARE;
+        }
+        int score = -negamax<!Color>(state, depth - 3, -beta, -beta + 1, lookup_tables, current_depth + 1, zobrist, null_zobrist_hash, moves_stack, undo_stack, transposition_table, child_pv, child_pv_length, killer_moves, history_moves, eval_policy);
+        state.en_passant_square = en_passant_square;
+        state.info = info;
         if (score >= beta) {
             //std::cout << "Null move pruning at depth " << depth << std::endl;
             return score;
@@ -257,15 +203,11 @@ int negamax(game_state &state, int depth, int alpha, int beta, bool color,
     
     // generate moves from the current position.
     // generate pseudo-legal moves
-    std::array<move, 256>& moves = moves_stack[current_depth];
-    int move_count = pseudo_legal_move_generator(moves, state, color, lookup_tables, occupancy_bitboard);
-
-    std::array<int, 256> move_order;
-    std::array<int, 256> scores;
-    int num_non_quiet = 0;
+    move_list& moves = moves_stack[current_depth];
+    int move_count = pseudo_legal_move_generator<Color>(moves, state, lookup_tables);
 
     // order moves
-    order_moves(move_order, scores, moves, move_count, piece_on_square, num_non_quiet, best_move, current_depth, killer_moves, history_moves);
+    order_moves<Color>(moves, move_count, state, lookup_tables, best_move, current_depth, depth, killer_moves, history_moves);
 
     int max_score = -INF;
     int best_move_index = -1;
@@ -273,68 +215,73 @@ int negamax(game_state &state, int depth, int alpha, int beta, bool color,
     int original_alpha = alpha;
     int original_beta = beta;
     bool LMR = false;
+    prefetch_hint child_hint = child_prefetch_hint(transposition_table, depth - 1);
 
     // iterate over all pseudo-legal moves
     for (int i = 0; i < move_count; i++) {
-        // get the move index from the sorted order
-        int move_index = move_order[i];
+        // ensure move is legal (not putting king in check), before it is made
+        if (!legal<Color>(state, moves[i], lookup_tables)) {
+            continue;
+        }
 
         move_undo& undo = undo_stack[current_depth];
-        apply_move(state, moves[move_index], zobrist_hash, zobrist, undo, piece_on_square, layer1, accumulator);
-        U64 new_occupancy = get_occupancy(state.piece_bitboards);
+        apply_move<Color>(state, moves[i], zobrist_hash, zobrist, undo, eval_policy, child_hint);
 
-        // ensure move is legal (not putting king in check)
-        if (pseudo_to_legal(state, !color, lookup_tables, new_occupancy)) {
-            // apply negamax
-            int score = -negamax(state, depth - 1 - LMR, -beta, -alpha, !color, lookup_tables, new_occupancy, current_depth + 1, zobrist, zobrist_hash, moves_stack, undo_stack, transposition_table, piece_on_square, child_pv, child_pv_length, killer_moves, history_moves, accumulator, layer1, layer2, layer3, layer4);
-            legal_moves++;
+        // apply negamax
+        int score = -negamax<!Color>(state, depth - 1 - LMR, -beta, -alpha, lookup_tables, current_depth + 1, zobrist, zobrist_hash, moves_stack, undo_stack, transposition_table, child_pv, child_pv_length, killer_moves, history_moves, eval_policy);
+        legal_moves++;
 
-            // late move reductions
-            if (!LMR && not_in_check && legal_moves > 2 && depth > 3) {
-                //LMR = true;
-            }
+        // Undo the move
+        undo_move<Color>(state, moves[i], zobrist_hash, undo, eval_policy);
 
-            if (score > max_score) {
-                max_score = score;
-                best_move_index = move_index;
+        // late move reductions
+        if (!LMR && not_in_check && legal_moves > 2 && depth > 3) {
+            //LMR = true;
+        }
 
-                pv[0] = moves[move_index];
-                for (int j = 0; j < child_pv_length; ++j) {
-                    pv[j + 1] = child_pv[j];
-                }
-                pv_length = child_pv_length + 1;
+        if (score > max_score) {
+            max_score = score;
+            best_move_index = i;
+
+            pv[0] = moves[i];
+            for (int j = 0; j < child_pv_length; ++j) {
+                pv[j + 1] = child_pv[j];
             }
-            if (score > alpha) {
-                alpha = score;
+            pv_length = child_pv_length + 1;
+        }
+        if (score > alpha) {
+            alpha = score;
+        }
+        if (alpha >= beta) {
+            // beta cutoff
+            // store the killer move
+            if (killer_moves[current_depth][0].from_position() != moves[i].from_position()) {
+                killer_moves[current_depth][1] = killer_moves[current_depth][0];
+                killer_moves[current_depth][0] = moves[i];
             }
-            if (alpha >= beta) {
-                // beta cutoff
-                // Undo the move
-                undo_move(state, moves[move_index], zobrist_hash, zobrist, undo, piece_on_square, layer1, accumulator);
-                
-                // store the killer move
-                if (killer_moves[current_depth][0].from_position != moves[move_index].from_position ) {
-                    killer_moves[current_depth][1] = killer_moves[current_depth][0];
-                    killer_moves[current_depth][0] = moves[move_index];
-                }
 
-                // update history heuristic score
-                if (i > num_non_quiet) {
-                    history_moves[moves[move_index].from_position][moves[move_index].to_position] += depth * depth;
+            // update history heuristic score, captures are ordered by MVV-LVA
+            // when a score reaches the quiet checks, the whole table is halved, which keeps the order of the quiet moves
+            if (state.piece_on_square[moves[i].to_position()] == NO_PIECE) {
+                int& history = history_moves[moves[i].from_position()][moves[i].to_position()];
+                history += depth * depth;
+                while (history >= QUIET_CHECK_SCORE) {
+                    for (auto& row : history_moves) {
+                        for (int& value : row) {
+                            value /= 2;
+                        }
+                    }
                 }
-
-                break;
             }
-        }
 
-        // Undo the move
-        undo_move(state, moves[move_index], zobrist_hash, zobrist, undo, piece_on_square, layer1, accumulator);
+            break;
+        }
     }
 
     // terminal node: checkmate or stalemate.
     if (legal_moves == 0) {
         // king is attacked: checkmate
-        if (pseudo_to_legal(state, !color, lookup_tables, occupancy_bitboard)) {
+        if (not_in_check) {
             // stalemate
             return 0;
         }
@@ -360,29 +307,34 @@ int negamax(game_state &state, int depth, int alpha, int beta, bool color,
     return max_score;
 }
 
+template <typename Eval>
 move iterative_deepening(game_state& state, int max_depth, bool color,
-    lookup_tables_wrap& lookup_tables, U64& occupancy_bitboard,
+    lookup_tables_wrap& lookup_tables,
     zobrist_randoms& zobrist, U64& zobrist_hash,
-    std::array<std::array<move, 256>, 256>& moves_stack, 
+    std::array<move_list, MAX_DEPTH>& moves_stack, 
     std::array<move_undo, 256>& undo_stack, 
     std::vector<transposition_table_entry>& transposition_table,
-    std::array<int, 64> piece_on_square,
     std::array<std::array<move, 2>, MAX_DEPTH>& killer_moves, 
     std::array<std::array<int, 64>, 64>& history_moves, 
-    NNUE_accumulator& accumulator,
-    const linear_layer<INPUT_SIZE, HIDDEN1_SIZE>& layer1,
-    const linear_layer<HIDDEN1_SIZE*2, HIDDEN2_SIZE>& layer2,
-    const linear_layer<HIDDEN2_SIZE, HIDDEN3_SIZE>& layer3,
-    const linear_layer<HIDDEN3_SIZE, OUTPUT_SIZE>& layer4) {
+    Eval& eval_policy) {
 
     auto start_time = std::chrono::high_resolution_clock::now();
     int time_limit_ms = 1000;
 
-    std::array<move, 256>& moves = moves_stack[0];
-    int move_count = pseudo_legal_move_generator(moves, state, color, lookup_tables, occupancy_bitboard);
+    // the checks and pins of the root, every other node computes its own
+    update_state_info(state, color, lookup_tables);
 
-    std::array<int, 256> move_order;
-    std::array<int, 256> scores;
+    move_list& moves = moves_stack[0];
+    int move_count = pseudo_legal_move_generator(moves, state, color, lookup_tables);
+
+    // checkmate or stalemate, there is nothing to search or to apply
+    bool has_legal_move = false;
+    for (int i = 0; i < move_count && !has_legal_move; i++) {
+        has_legal_move = legal(state, moves[i], color, lookup_tables);
+    }
+    if (!has_legal_move) {
+        return move();
+    }
 
     int root_PV_moves_count = 0;
     std::array<move, MAX_DEPTH> best_PV_moves;
@@ -407,75 +359,77 @@ move iterative_deepening(game_state& state, int max_depth, bool color,
             int score = 0;
 
             // check for capture
-            int victim_index = piece_on_square[moves[i].to_position];
-            if (victim_index > 0) {
+            int victim_index = state.piece_on_square[moves[i].to_position()];
+            if (victim_index != NO_PIECE) {
                 int victim_value = piece_values[victim_index%6];
-                int attacker_value = piece_values[moves[i].piece_index%6];
+                int attacker_value = piece_values[state.piece_on_square[moves[i].from_position()]%6];
                 score = victim_value*10 - attacker_value;
             }
             
             // check for best move if not in the first iteration
-            if (negamax_depth > 0 &&
-                moves[i].piece_index == best_PV_moves[0].piece_index &&
-                moves[i].from_position == best_PV_moves[0].from_position &&
-                moves[i].to_position == best_PV_moves[0].to_position) {
+            if (negamax_depth > 0 && moves[i] == best_PV_moves[0]) {
                 score += INF;
             }
 
-            scores[i] = score;
-            move_order[i] = i; // store the index
+            moves.entries[i].score = score;
         }
 
         // sort moves based on scores
-        std::sort(move_order.begin(), move_order.begin() + move_count, [&](int a, int b) {
-            return scores[a] > scores[b];
-        });
+        moves.sort();
 
         // apply negamax
-        int max_score = -INF;
+        // below -INF, so a move is chosen even when every move gets mated
+        int max_score = -INF - 1;
+        prefetch_hint child_hint = child_prefetch_hint(transposition_table, negamax_depth);
 
         // iterate over all pseudo-legal moves
         for (int i = 0; i < move_count; i++) {
-            // get the move index from the sorted order
-            int move_index = move_order[i];
-
             // print the move
-            //std::cout << "Move: " << index_to_chess(moves[move_index].from_position) 
-            //          << " -> " << index_to_chess(moves[move_index].to_position) << std::endl;
+            //std::cout << "Move: " << index_to_chess(moves[i].from_position()) 
+            //          << " -> " << index_to_chess(moves[i].to_position()) << std::endl;
+
+            // ensure move is legal (not putting king in check), before it is made
+            if (!legal(state, moves[i], color, lookup_tables)) {
+                continue;
+            }
 
             move_undo& undo = undo_stack[0];
-            apply_move(state, moves[move_index], zobrist_hash, zobrist, undo, piece_on_square, layer1, accumulator);
-            
-            U64 new_occupancy = get_occupancy(state.piece_bitboards);
-
-            // ensure move is legal (not putting king in check)
-            if (pseudo_to_legal(state, !color, lookup_tables, new_occupancy)) {
-                
-                // apply negamax
-                int score = -negamax(state, negamax_depth, -INF, INF, !color, lookup_tables, new_occupancy, 1, zobrist, zobrist_hash, moves_stack, undo_stack, transposition_table, piece_on_square, root_PV_moves, root_PV_moves_count, killer_moves, history_moves, accumulator, layer1, layer2, layer3, layer4);
-
-                if (score > max_score) {
-                    max_score = score;
-                    best_PV_moves = root_PV_moves;
-                    best_PV_moves[0] = moves[move_index];
-                    for (int j = 0; j < root_PV_moves_count; ++j) {
-                        best_PV_moves[j + 1] = root_PV_moves[j];
-                    }
+            apply_move(state, moves[i], zobrist_hash, zobrist, undo, eval_policy, child_hint);
+
+            // apply negamax
+            // the child is searched with the instantiation of the other side
+            int score = color ?
+                -negamax<false>(state, negamax_depth, -INF, INF, lookup_tables, 1, zobrist, zobrist_hash, moves_stack, undo_stack, transposition_table, root_PV_moves, root_PV_moves_count, killer_moves, history_moves, eval_policy) :
+                -negamax<true>(state, negamax_depth, -INF, INF, lookup_tables, 1, zobrist, zobrist_hash, moves_stack, undo_stack, transposition_table, root_PV_moves, root_PV_moves_count, killer_moves, history_moves, eval_policy);
+
+            if (score > max_score) {
+                max_score = score;
+                best_PV_moves = root_PV_moves;
+                best_PV_moves[0] = moves[i];
+                for (int j = 0; j < root_PV_moves_count; ++j) {
+                    best_PV_moves[j + 1] = root_PV_moves[j];
                 }
             }
 
             // Undo the move
-            undo_move(state, moves[move_index], zobrist_hash, zobrist, undo, piece_on_square, layer1, accumulator);
+            undo_move(state, moves[i], zobrist_hash, undo, eval_policy);
         }
 
         //std::cout << "Depth: " << negamax_depth << ", Score: " << max_score << std::endl;
     }
 
     // update state
-    occupancy_bitboard = get_occupancy(state.piece_bitboards);
-    apply_move(state, best_PV_moves[0], zobrist_hash, zobrist, undo_stack[0], piece_on_square, layer1, accumulator);
+    apply_move(state, best_PV_moves[0], zobrist_hash, zobrist, undo_stack[0], eval_policy);
     
     //visualize_game_state(state);  
 
     return best_PV_moves[0];
-}
\ No newline at end of file
+}
+
+// search for every evaluation policy
+template move iterative_deepening<handcrafted_eval>(game_state&, int, bool, lookup_tables_wrap&, zobrist_randoms&, U64&,
+    std::array<move_list, MAX_DEPTH>&, std::array<move_undo, 256>&, std::vector<transposition_table_entry>&,
+    std::array<std::array<move, 2>, MAX_DEPTH>&, std::array<std::array<int, 64>, 64>&, handcrafted_eval&);
+template move iterative_deepening<nnue_eval>(game_state&, int, bool, lookup_tables_wrap&, zobrist_randoms&, U64&,
+    std::array<move_list, MAX_DEPTH>&, std::array<move_undo, 256>&, std::vector<transposition_table_entry>&,
+    std::array<std::array<move, 2>, MAX_DEPTH>&, std::array<std::array<int, 64>, 64>&, nnue_eval&);
\ No newline at end of file
@@ -1,4 +1,4 @@
-#include "move_generation.h"
+#include "position_evaluation.h"
 #include <limits>
 #include <string>
 #include <algorithm>
@@ -22,51 +22,56 @@ constexpr int king_value = 20000;
 constexpr std::array<int, 6> piece_values = {pawn_value, knight_value, bishop_value, rook_value, queen_value, king_value};
 
 // transposition tables
+// 16 bytes, the fields are ordered by size so there is no padding between them
 struct transposition_table_entry {
     U64 hash;
-    uint8_t depth;
     int score;
-    uint8_t flag; // 0: exact, 1: alpha, 2: beta
     move best_move;
+    uint8_t depth;
+    uint8_t flag; // 0: exact, 1: alpha, 2: beta
 };
+static_assert(sizeof(transposition_table_entry) == 16, "a table entry has to stay 16 bytes");
+
+// make-move prefetches the transposition table entry of a child that is searched, and the evaluation of a child that is a leaf
+inline prefetch_hint child_prefetch_hint(const std::vector<transposition_table_entry>& transposition_table, int child_depth) {
+    if (child_depth == 0) {
+        return {nullptr, 0, 0, true};
+    }
+    return {reinterpret_cast<const char*>(transposition_table.data()), sizeof(transposition_table_entry), TT_SIZE - 1, false};
+}
 
 //useful functions
 std::string index_to_chess(int index);
 void visualize_game_state(const game_state& state);
 
-//evaluation
-int evaluation(game_state &state);
-
 // search algorithm
 
+// search functions are templates on the evaluation policy (handcrafted_eval or nnue_eval)
+// both are instantiated in search_module.cpp
+
 // fast negamax search with alpha-beta pruning.
-int negamax(game_state &state, int depth, int alpha, int beta, bool color, 
-    lookup_tables_wrap& lookup_tables, const U64& occupancy_bitboard, int current_depth,
+// Color is the side to move
+template <bool Color, typename Eval>
+int negamax(game_state &state, int depth, int alpha, int beta, 
+    lookup_tables_wrap& lookup_tables, int current_depth,
     zobrist_randoms& zobrist, U64& zobrist_hash,
-    std::array<std::array<move, 256>, 256>& moves_stack, 
+    std::array<move_list, MAX_DEPTH>& moves_stack, 
     std::array<move_undo, 256>& undo_stack,
     std::vector<transposition_table_entry>& transposition_table,
-    std::array<int, 64>& piece_on_square,
     std::array<move, MAX_DEPTH>& pv, int& pv_length,
     std::array<std::array<move, 2>, MAX_DEPTH>& killer_moves,
     std::array<std::array<int, 64>, 64>& history_moves,
-    NNUE_accumulator& accumulator,
-    const linear_layer<INPUT_SIZE, HIDDEN1_SIZE>& layer1,
-    const linear_layer<HIDDEN1_SIZE*2, HIDDEN2_SIZE>& layer2,
-    const linear_layer<HIDDEN2_SIZE, HIDDEN3_SIZE>& layer3,
-    const linear_layer<HIDDEN3_SIZE, OUTPUT_SIZE>& layer4);
+    Eval& eval_policy);
 
+// searches the position for about a second and applies the best move to it
+// without a legal move, the null move (a1a1) is returned and nothing is applied
+template <typename Eval>
 move iterative_deepening(game_state& state, int max_depth, bool color,
-    lookup_tables_wrap& lookup_tables, U64& occupancy_bitboard,
+    lookup_tables_wrap& lookup_tables,
     zobrist_randoms& zobrist, U64& zobrist_hash,
-    std::array<std::array<move, 256>, 256>& moves_stack, 
+    std::array<move_list, MAX_DEPTH>& moves_stack, 
     std::array<move_undo, 256>& undo_stack, 
     std::vector<transposition_table_entry>& transposition_table,
-    std::array<int, 64> piece_on_square,
     std::array<std::array<move, 2>, MAX_DEPTH>& killer_moves,
     std::array<std::array<int, 64>, 64>& history_moves, 
-    NNUE_accumulator& accumulator,
-    const linear_layer<INPUT_SIZE, HIDDEN1_SIZE>& layer1,
-    const linear_layer<HIDDEN1_SIZE*2, HIDDEN2_SIZE>& layer2,
-    const linear_layer<HIDDEN2_SIZE, HIDDEN3_SIZE>& layer3,
-    const linear_layer<HIDDEN3_SIZE, OUTPUT_SIZE>& layer4);
\ No newline at end of file
+    Eval& eval_policy);
\ No newline at end of file
@@ -6,27 +6,35 @@
 
 // make my engine UCI compliant
 
+// positions searched by the bench command, openings, middlegames and endgames
+const std::array<std::string, 8> BENCH_POSITIONS = {
+    "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+    "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+    "r1bq1rk1/pp2bppp/2n1pn2/3p4/2PP4/2N1PN2/PP3PPP/R2QKB1R w KQ - 0 8",
+    "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10",
+    "2kr3r/ppp2ppp/2n5/2b1q3/4P3/2N1BQ2/PPP2PPP/R4RK1 b - - 0 14",
+    "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+    "8/5pk1/6p1/3Q4/8/6P1/5PK1/1q6 w - - 0 40",
+    "6k1/5ppp/8/8/8/8/1Q3PPP/R5K1 w - - 0 1"};
+
 //move format is long algebraic notation
 std::string move_to_long_algebraic(move m) {
-    char from_file = 'a' + (m.from_position % 8);
-    char from_rank = '1' + (m.from_position / 8);
-    char to_file = 'a' + (m.to_position % 8);
-    char to_rank = '1' + (m.to_position / 8);
+    // the null move, sent when there is no legal move
+    if (m == move()) {
+        return "0000";
+    }
+
+    char from_file = 'a' + (m.from_position() % 8);
+    char from_rank = '1' + (m.from_position() / 8);
+    char to_file = 'a' + (m.to_position() % 8);
+    char to_rank = '1' + (m.to_position() / 8);
 
     std::string move_string = std::string(1, from_file) + std::string(1, from_rank) +
            std::string(1, to_file) + std::string(1, to_rank);
 
-    if (m.promotion_piece_index != m.piece_index) {
-        char promotion_piece = 'n';
-        if (m.promotion_piece_index == 2 || m.promotion_piece_index == 8) {
-            promotion_piece = 'b';
-        } else if (m.promotion_piece_index == 3 || m.promotion_piece_index == 9) {
-            promotion_piece = 'r';
-        } else if (m.promotion_piece_index == 4 || m.promotion_piece_index == 10) {
-            promotion_piece = 'q';
-        }
-
-        move_string += promotion_piece;
+    if (m.promotion()) {
+        // promotion types 1 to 4 are knight, bishop, rook and queen
+        move_string += "nbrq"[m.promotion_type() - 1];
     }
 
     return move_string;
@@ -36,7 +44,7 @@ game_state fen_to_game_state(const std::string& fen, bool& color) {
     // parse FEN string and update the game state
     
     // create empty game state
-    game_state state({0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0}, {0, 0}, false, false, false, false);
+    game_state state({0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0}, NO_SQUARE, 0);
 
     // parse the FEN string
     std::string sub_fen;
@@ -73,21 +81,21 @@ game_state fen_to_game_state(const std::string& fen, bool& color) {
                 case 'q': piece_index = 10; break; // black queen
                 case 'k': piece_index = 11; break; // black king
             }
-            state.piece_bitboards[piece_index] |= (1ULL << (rank*8 + file));
+            state.add_piece(piece_index, rank*8 + file);
             file += 1; // move to the next file
         }
     }
 
-    // color
-    color = (sub_fen_elements[1] == "w") ? true : false;
+    // color, false for white
+    color = sub_fen_elements[1] == "b";
 
     // castling rights
     for(const char& c : sub_fen_elements[2]) {
         switch (c) {
-            case 'K': state.w_short_castle = true; break;
-            case 'Q': state.w_long_castle = true; break;
-            case 'k': state.b_short_castle = true; break;
-            case 'q': state.b_long_castle = true; break;
+            case 'K': state.castling_rights |= WHITE_SHORT_CASTLE; break;
+            case 'Q': state.castling_rights |= WHITE_LONG_CASTLE; break;
+            case 'k': state.castling_rights |= BLACK_SHORT_CASTLE; break;
+            case 'q': state.castling_rights |= BLACK_LONG_CASTLE; break;
         }
     }
     
@@ -95,25 +103,74 @@ game_state fen_to_game_state(const std::string& fen, bool& color) {
     if (sub_fen_elements[3] != "-") {
         int file = sub_fen_elements[3][0] - 'a';
         int rank = sub_fen_elements[3][1] - '1';
-        state.en_passant_bitboards[color] = (1ULL << (rank*8 + file));
+        // only kept if a pawn of the side to move can capture the pushed pawn
+        int en_passant_square = rank*8 + file;
+        int pushed_position = en_passant_square + (color ? 8 : -8);
+        if (state.en_passant_attackers(pushed_position, color)) {
+            state.en_passant_square = en_passant_square;
+        }
     }
 
     return state;
 }
 
-void save_lookup_tables(const lookup_tables_wrap& tables, const std::string& filename) {
-    std::ofstream out(filename, std::ios::binary);
-    if (!out) throw std::runtime_error("Failed to open file for writing");
-    out.write(reinterpret_cast<const char*>(&tables), sizeof(tables));
+void reset_accumulator(const quantized_network* network, accumulator_stack& accumulators, const std::array<U64, 12>& piece_bitboards) {
+    // compute the accumulator from scratch, nothing to do without a network
+    accumulators.current = 0;
+    if (network) {
+        reset_accumulator_stack(network->layer1, accumulators, piece_bitboards);
+    }
 }
 
-void load_lookup_tables(lookup_tables_wrap& tables, const std::string& filename) {
-    std::ifstream in(filename, std::ios::binary);
-    if (!in) throw std::runtime_error("Failed to open file for reading");
-    in.read(reinterpret_cast<char*>(&tables), sizeof(tables));
+void collapse_accumulator(const quantized_network* network, accumulator_stack& accumulators, const std::array<U64, 12>& piece_bitboards) {
+    // game moves are never undone, keep the stack from growing over the course of a game
+    if (network) {
+        collapse_accumulator_stack(network->layer1, accumulators, piece_bitboards);
+    }
+    accumulators.current = 0;
 }
 
-int main() {
+int score_fen_file(const quantized_network* network, const std::string& input_path, const std::string& output_path, int num_threads) {
+    // batch scoring, one FEN per line in, one score per line out
+    // scores are in centipawns, from the perspective of the side to move
+
+    if (!network) {
+        std::cerr << "scoring needs a network" << std::endl;
+        return 1;
+    }
+
+    std::ifstream in(input_path);
+    if (!in) {
+        std::cerr << "cannot open " << input_path << std::endl;
+        return 1;
+    }
+
+    std::vector<nnue_position> positions;
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.empty()) {
+            continue;
+        }
+        bool color = false;
+        game_state state = fen_to_game_state(line, color);
+        positions.push_back({state.piece_bitboards(), color});
+    }
+
+    std::vector<int> scores(positions.size());
+    auto start = std::chrono::steady_clock::now();
+    nnue_evaluate_batch(*network, positions.data(), scores.data(), positions.size(), num_threads);
+    std::chrono::duration<double> duration = std::chrono::steady_clock::now() - start;
+
+    std::ofstream out(output_path);
+    for (int score : scores) {
+        out << score << "\n";
+    }
+
+    std::cout << positions.size() << " positions, " << static_cast<long long>(positions.size() / duration.count()) << " positions/s" << std::endl;
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
     // initial game state
     // convention: least significant bit (rightmost bit) is A1
 
@@ -132,47 +189,49 @@ int main() {
     U64 b_queen = 576460752303423488;
     U64 b_king = 1152921504606846976;
 
-    U64 w_en_passant = 0;
-    U64 b_en_passant = 0;
-
-    bool w_long_castle = true;
-    bool w_short_castle = true;
-    bool b_long_castle = true;
-    bool b_short_castle = true;
-
     // initialize game state
     std::array<U64, 12> piece_bitboards = {w_pawn, w_knight, w_bishop, w_rook, w_queen, w_king, b_pawn, b_knight, b_bishop, b_rook, b_queen, b_king};
-    std::array<U64, 2> en_passant_bitboards = {w_en_passant, b_en_passant};
-    game_state initial_game_state(piece_bitboards, en_passant_bitboards, w_long_castle, w_short_castle, b_long_castle, b_short_castle);
-
-    // create neural network layers
-    linear_layer<INPUT_SIZE, HIDDEN1_SIZE> layer1;
-    linear_layer<HIDDEN1_SIZE*2, HIDDEN2_SIZE> layer2;
-    linear_layer<HIDDEN2_SIZE, HIDDEN3_SIZE> layer3;
-    linear_layer<HIDDEN3_SIZE, OUTPUT_SIZE> layer4;
-    load_layer(layer1, "/home/yvlaere/Projects/yvl-chess/NNUE_training/model/layer1_weights.txt", "/home/yvlaere/Projects/yvl-chess/NNUE_training/model/layer1_biases.txt");
-    load_layer(layer2, "/home/yvlaere/Projects/yvl-chess/NNUE_training/model/layer2_weights.txt", "/home/yvlaere/Projects/yvl-chess/NNUE_training/model/layer2_biases.txt");
-    load_layer(layer3, "/home/yvlaere/Projects/yvl-chess/NNUE_training/model/layer3_weights.txt", "/home/yvlaere/Projects/yvl-chess/NNUE_training/model/layer3_biases.txt");
-    load_layer(layer4, "/home/yvlaere/Projects/yvl-chess/NNUE_training/model/layer4_weights.txt", "/home/yvlaere/Projects/yvl-chess/NNUE_training/model/layer4_biases.txt");
+    game_state initial_game_state(piece_bitboards, NO_SQUARE, ALL_CASTLING);
+
+#ifdef HANDCRAFTED_EVAL
+    // handcrafted build, no network is loaded and the NNUE search is never used
+    nnue_file network_file;
+    std::string default_eval_file;
+#else
+    // load the neural network
+    // the embedded network is the default, otherwise a network file in the working directory is used
+    // without a network, the handcrafted evaluation is used
+    nnue_file network_file = embedded_network();
+    std::string default_eval_file = network_file.network ? network_file.name : "yvl.nnue";
+    if (!network_file.network) {
+        try {
+            network_file = load_network(default_eval_file);
+        }
+        catch (const std::runtime_error& e) {
+            std::cout << "info string " << e.what() << ", using handcrafted evaluation" << std::endl;
+        }
+    }
+#endif
+
+    // batch scoring mode: yvl-bot score <fen file> <score file> [threads]
+    if (argc >= 4 && std::string(argv[1]) == "score") {
+        return score_fen_file(network_file.network, argv[2], argv[3], argc >= 5 ? std::stoi(argv[4]) : 0);
+    }
 
     //std::cout << "timepoint 1: " << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start_time).count() << " ms" << std::endl;
 
     // create lookup tables
     lookup_tables_wrap lookup_tables;
-    //generate_lookup_tables(lookup_tables);
-
-    //save_lookup_tables(lookup_tables, "lookup_tables.bin");
-    load_lookup_tables(lookup_tables, "/home/yvlaere/Projects/yvl-chess/lookup_tables.bin");
+    generate_lookup_tables(lookup_tables);
 
     //std::cout << "timepoint 2: " << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start_time).count() << " ms" << std::endl;
 
-
     // create zobrist randoms
     zobrist_randoms zobrist;
 
     // create move object array
     //untill depth 256
-    std::array<std::array<move, 256>, MAX_DEPTH> moves_stack;
+    std::array<move_list, MAX_DEPTH> moves_stack;
 
     // create move undo object array
     std::array<move_undo, 256> undo_stack;
@@ -193,23 +252,82 @@ int main() {
     // initialize
     game_state state = initial_game_state;
 
-    std::array<int, 64> piece_on_square;
-    piece_on_square.fill(-1);
-    U64 zobrist_hash = init_zobrist_hashing_mailbox(state, zobrist, false, piece_on_square);
-    U64 occupancy_bitboard = get_occupancy(state.piece_bitboards);
+    U64 zobrist_hash = init_zobrist_hashing(state, zobrist, false);
     int negamax_depth = 9;
     bool color = false;
 
     //std::cout << "timepoint 3: " << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start_time).count() << " ms" << std::endl;
 
 
-    // NNUE accumulator
-    NNUE_accumulator accumulator;
-    std::vector<int> active_features_w;
-    std::vector<int> active_features_b;
-    game_state_to_input(piece_on_square, active_features_w, active_features_b);
-    refresh_accumulator(layer1, accumulator, active_features_w, false);
-    refresh_accumulator(layer1, accumulator, active_features_b, true);
+    // NNUE accumulator stack
+    // vector to put it on the heap
+    std::vector<accumulator_stack> accumulator_storage(1);
+    accumulator_stack& accumulators = accumulator_storage[0];
+
+    // pawn hash table of the handcrafted evaluation
+    std::vector<pawn_hash_entry> pawn_table(PAWN_TABLE_SIZE);
+
+    // evaluation cache of the NNUE, has to be cleared when the network changes
+    std::vector<eval_cache_entry> eval_cache(EVAL_CACHE_SIZE);
+
+    // evaluation backend, each one has its own instantiation of the search
+    // NNUE when a network is loaded and enabled, the handcrafted evaluation otherwise
+    bool use_nnue = true;
+    auto active_network = [&]() -> const quantized_network* {
+        return use_nnue ? network_file.network : nullptr;
+    };
+    reset_accumulator(active_network(), accumulators, state.piece_bitboards());
+
+    // positions where the material is this far outside the window skip the network, -1 turns it off
+    int lazy_margin = DEFAULT_LAZY_MARGIN;
+
+    // benchmark mode: yvl-bot bench [lazy margin]
+    if (argc >= 2 && std::string(argv[1]) == "bench") {
+        if (argc >= 3) {
+            lazy_margin = std::stoi(argv[2]);
+        }
+
+        // search every bench position with a fresh transposition table and evaluation cache and sum the counters
+        auto run_bench = [&](const std::string& name, auto make_eval) {
+            eval_stats total;
+            double seconds = 0.0;
+            for (const std::string& fen : BENCH_POSITIONS) {
+                bool bench_color = false;
+                game_state bench_state = fen_to_game_state(fen, bench_color);
+                U64 bench_hash = init_zobrist_hashing(bench_state, zobrist, bench_color);
+                std::fill(transposition_table.begin(), transposition_table.end(), transposition_table_entry{});
+                std::fill(eval_cache.begin(), eval_cache.end(), eval_cache_entry{});
+
+                auto eval = make_eval(bench_state);
+                auto start = std::chrono::steady_clock::now();
+                iterative_deepening(bench_state, negamax_depth, bench_color, lookup_tables, zobrist, bench_hash, moves_stack, undo_stack, transposition_table, killer_moves, history_moves, eval);
+                seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                total.add(eval.stats);
+            }
+
+            auto percentage = [](U64 part, U64 whole) { return whole ? 100.0 * part / whole : 0.0; };
+            std::cout << name << ": " << total.moves << " nodes, " << seconds << " s, " << static_cast<long long>(total.moves / seconds) << " nodes/s, "
+                      << total.evaluations << " evaluations, " << total.lazy_evaluations << " lazy (" << percentage(total.lazy_evaluations, total.evaluations) << "%), "
+                      << "eval cache hits " << percentage(total.cache_hits, total.cache_probes) << "%" << std::endl;
+        };
+
+        run_bench("handcrafted", [&](const game_state& bench_state) {
+            return handcrafted_eval(bench_state, zobrist, pawn_table);
+        });
+        if (const quantized_network* network = active_network()) {
+            // every shortcut is added in turn, the difference in nodes/s is its gain
+            auto run_nnue_bench = [&](const std::string& name, std::vector<eval_cache_entry>* cache, int margin) {
+                run_bench(name, [&](const game_state& bench_state) {
+                    reset_accumulator(network, accumulators, bench_state.piece_bitboards());
+                    return nnue_eval(bench_state, accumulators, *network, cache, margin);
+                });
+            };
+            run_nnue_bench("nnue", nullptr, LAZY_EVAL_OFF);
+            run_nnue_bench("nnue, lazy margin " + std::to_string(lazy_margin), nullptr, lazy_margin);
+            run_nnue_bench("nnue, lazy margin " + std::to_string(lazy_margin) + ", eval cache", &eval_cache, lazy_margin);
+        }
+        return 0;
+    }
 
     //std::cout << "timepoint 4: " << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start_time).count() << " ms" << std::endl;
 
@@ -231,6 +349,11 @@ int main() {
         if (sub_commands[0] == "uci") {
             std::cout << "id name yvl-bot" << std::endl;
             std::cout << "id author yvl" << std::endl;
+#ifndef HANDCRAFTED_EVAL
+            std::cout << "option name EvalFile type string default " << default_eval_file << std::endl;
+            std::cout << "option name UseNNUE type check default " << (use_nnue ? "true" : "false") << std::endl;
+            std::cout << "option name LazyMargin type spin default " << DEFAULT_LAZY_MARGIN << " min -1 max 100000" << std::endl;
+#endif
             std::cout << "uciok" << std::endl;
             continue;
         }
@@ -241,29 +364,56 @@ int main() {
         else if (sub_commands[0] == "quit") {
             break;
         }
+        else if (sub_commands[0] == "setoption") {
+            // setoption name <id> value <x>
+            if (sub_commands.size() >= 5 && sub_commands[1] == "name" && sub_commands[2] == "EvalFile" && sub_commands[3] == "value") {
+                std::string path = sub_commands[4];
+                for (int i = 5; i < sub_commands.size(); i++) {
+                    path += " " + sub_commands[i];
+                }
+
+                // hot-swap the network, the old one stays active if the new one can not be loaded
+                try {
+                    nnue_file new_network_file = (path == "<embedded>") ? embedded_network() : load_network(path);
+                    if (!new_network_file.network) {
+                        throw std::runtime_error("no embedded network");
+                    }
+                    unload_network(network_file);
+                    network_file = new_network_file;
+                    reset_accumulator(active_network(), accumulators, state.piece_bitboards());
+                    std::fill(eval_cache.begin(), eval_cache.end(), eval_cache_entry{});
+                    std::cout << "info string loaded network " << network_file.name << std::endl;
+                }
+                catch (const std::runtime_error& e) {
+                    std::cout << "info string " << e.what() << std::endl;
+                }
+            }
+            else if (sub_commands.size() >= 5 && sub_commands[1] == "name" && sub_commands[2] == "UseNNUE" && sub_commands[3] == "value") {
+                // switch between the two search instantiations
+                use_nnue = sub_commands[4] == "true";
+                if (use_nnue && !network_file.network) {
+                    std::cout << "info string no network loaded, using handcrafted evaluation" << std::endl;
+                }
+                reset_accumulator(active_network(), accumulators, state.piece_bitboards());
+            }
+            else if (sub_commands.size() >= 5 && sub_commands[1] == "name" && sub_commands[2] == "LazyMargin" && sub_commands[3] == "value") {
+                lazy_margin = std::stoi(sub_commands[4]);
+            }
+            continue;
+        }
         else if (sub_commands[0] == "ucinewgame") {
             // reset the game state
             state = initial_game_state;
-            zobrist_hash = init_zobrist_hashing_mailbox(state, zobrist, false, piece_on_square);
-            occupancy_bitboard = get_occupancy(state.piece_bitboards);
-            std::vector<int> active_features_w;
-            std::vector<int> active_features_b;
-            game_state_to_input(piece_on_square, active_features_w, active_features_b);
-            refresh_accumulator(layer1, accumulator, active_features_w, false);
-            refresh_accumulator(layer1, accumulator, active_features_b, true);
+            zobrist_hash = init_zobrist_hashing(state, zobrist, false);
+            reset_accumulator(active_network(), accumulators, state.piece_bitboards());
             continue;
         }
         else if (sub_commands[0] == "position") {
             if (sub_commands[1] == "startpos") {
                 // reset the game state
                 state = initial_game_state;
-                zobrist_hash = init_zobrist_hashing_mailbox(state, zobrist, false, piece_on_square);
-                occupancy_bitboard = get_occupancy(state.piece_bitboards);
-                std::vector<int> active_features_w;
-                std::vector<int> active_features_b;
-                game_state_to_input(piece_on_square, active_features_w, active_features_b);
-                refresh_accumulator(layer1, accumulator, active_features_w, false);
-                refresh_accumulator(layer1, accumulator, active_features_b, true);
+                zobrist_hash = init_zobrist_hashing(state, zobrist, false);
+                reset_accumulator(active_network(), accumulators, state.piece_bitboards());
                 color = false;
             }
             else if (sub_commands[1] == "fen") {
@@ -273,7 +423,7 @@ int main() {
                 std::string fen_string;
                 for (int i = 2; i < sub_commands.size(); i++) {
                     std::string fen_part;
-                    fen_part = sub_commands[2 + i];
+                    fen_part = sub_commands[i];
                     if (fen_part == "moves") {
                         break;
                     }
@@ -283,13 +433,8 @@ int main() {
                 }
 
                 state = fen_to_game_state(fen_string, color);
-                zobrist_hash = init_zobrist_hashing_mailbox(state, zobrist, color, piece_on_square);
-                occupancy_bitboard = get_occupancy(state.piece_bitboards);
-                std::vector<int> active_features_w;
-                std::vector<int> active_features_b;
-                game_state_to_input(piece_on_square, active_features_w, active_features_b);
-                refresh_accumulator(layer1, accumulator, active_features_w, false);
-                refresh_accumulator(layer1, accumulator, active_features_b, true);
+                zobrist_hash = init_zobrist_hashing(state, zobrist, color);
+                reset_accumulator(active_network(), accumulators, state.piece_bitboards());
             }
             for (int i = 2; i < sub_commands.size(); i++) {
                 if (sub_commands[i] == "moves") {
@@ -298,15 +443,23 @@ int main() {
                         std::string move_string = sub_commands[j];
 
                         // generate all moves
-                        std::array<move, 256> moves;
-                        U64 occupancy_bitboard = get_occupancy(state.piece_bitboards);
-                        int move_count = pseudo_legal_move_generator(moves, state, color, lookup_tables, occupancy_bitboard);
+                        move_list moves;
+                        update_state_info(state, color, lookup_tables);
+                        int move_count = pseudo_legal_move_generator(moves, state, color, lookup_tables);
                         for (int k = 0; k < move_count; k++) {
                             std::string move_string = move_to_long_algebraic(moves[k]);
                             if (move_string == sub_commands[j]) {
                                 // apply move
                                 move_undo undo;
-                                apply_move(state, moves[k], zobrist_hash, zobrist, undo, piece_on_square, layer1, accumulator);
+                                if (const quantized_network* network = active_network()) {
+                                    nnue_eval eval(state, accumulators, *network, &eval_cache, lazy_margin);
+                                    apply_move(state, moves[k], zobrist_hash, zobrist, undo, eval);
+                                    collapse_accumulator(network, accumulators, state.piece_bitboards());
+                                }
+                                else {
+                                    handcrafted_eval eval(state, zobrist, pawn_table);
+                                    apply_move(state, moves[k], zobrist_hash, zobrist, undo, eval);
+                                }
                                 color = !color;
                                 break;
                             }
@@ -318,8 +471,18 @@ int main() {
         else if (sub_commands[0] == "go") {
             // start the search
 
-            U64 occupancy_bitboard = get_occupancy(state.piece_bitboards);
-            move best_move = iterative_deepening(state, negamax_depth, color, lookup_tables, occupancy_bitboard, zobrist, zobrist_hash, moves_stack, undo_stack, transposition_table, piece_on_square, killer_moves, history_moves, accumulator, layer1, layer2, layer3, layer4);
+            move best_move;
+            if (const quantized_network* network = active_network()) {
+                nnue_eval eval(state, accumulators, *network, &eval_cache, lazy_margin);
+                best_move = iterative_deepening(state, negamax_depth, color, lookup_tables, zobrist, zobrist_hash, moves_stack, undo_stack, transposition_table, killer_moves, history_moves, eval);
+
+                // the search applied the best move
+                collapse_accumulator(network, accumulators, state.piece_bitboards());
+            }
+            else {
+                handcrafted_eval eval(state, zobrist, pawn_table);
+                best_move = iterative_deepening(state, negamax_depth, color, lookup_tables, zobrist, zobrist_hash, moves_stack, undo_stack, transposition_table, killer_moves, history_moves, eval);
+            }
             std::cout << "bestmove " << move_to_long_algebraic(best_move) << std::endl;
         }
     }